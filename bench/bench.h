@@ -0,0 +1,54 @@
+//
+// Shared pieces of the benchmark programs.
+//
+
+#ifndef PROGRAM_BENCH_H
+#define PROGRAM_BENCH_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Shapes of synthetic programs, each stressing a different part of the front end.
+enum class ProgramShape {
+  IDENTIFIERS,  // long identifiers, few operators
+  OPERATORS,    // dense expressions of short tokens
+  COMMENTS,     // deep indentation and large comment blocks
+  NESTED,       // deeply nested BEGIN/END blocks and parentheses
+  MIXED         // a blend of all of the above
+};
+
+const std::vector<ProgramShape>& allProgramShapes();
+const char* shapeName(ProgramShape shape);
+
+// Generates a valid program of roughly the given size. The same seed always
+// produces the same program.
+std::string generateProgram(ProgramShape shape, size_t bytes, unsigned seed = 1);
+
+inline double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Calls run(i) for each repetition i, which times its own work and returns the
+// seconds taken, and returns the fastest. Best of several runs, so one slow run
+// does not hide a regression or fake an improvement.
+template <typename Run>
+double bestOf(int repetitions, Run run) {
+  double best = 0;
+  for (int i = 0; i < repetitions; ++i) {
+    double seconds = run(i);
+    if (i == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+inline void warnIfUnoptimized() {
+#ifndef __OPTIMIZE__
+  std::cerr << "warning: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release for real numbers" << std::endl;
+#endif
+}
+
+#endif //PROGRAM_BENCH_H
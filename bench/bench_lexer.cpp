@@ -0,0 +1,55 @@
+//
+// Measures Lexer::getNextToken throughput on synthetic programs.
+//
+// Usage: bench_lexer [megabytes] [repetitions] [shape]
+//
+
+#include "interpreter.h"
+#include "bench.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+size_t lexAll(const std::shared_ptr<SourceBuffer>& source) {
+  Lexer lexer(source);
+  size_t count = 0;
+  for (Token token = lexer.getNextToken(); token.type != Token::Type::END_OF_FILE; token = lexer.getNextToken()) {
+    count++;
+  }
+  return count;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+  int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+  const char* only = argc > 3 ? argv[3] : nullptr;
+  warnIfUnoptimized();
+
+  std::cout << std::left << std::setw(12) << "shape" << std::right
+            << std::setw(10) << "MB" << std::setw(12) << "tokens"
+            << std::setw(12) << "MB/s" << std::setw(14) << "Mtokens/s" << std::endl;
+  for (ProgramShape shape : allProgramShapes()) {
+    if (only != nullptr && std::strcmp(only, shapeName(shape)) != 0) {
+      continue;
+    }
+    auto source = SourceBuffer::fromString(generateProgram(shape, megabytes << 20));
+    double size = static_cast<double>(source->size()) / (1 << 20);
+
+    size_t tokens = 0;
+    double best = bestOf(repetitions, [&](int) {
+      auto start = std::chrono::steady_clock::now();
+      tokens = lexAll(source);
+      return secondsSince(start);
+    });
+
+    std::cout << std::left << std::setw(12) << shapeName(shape) << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << size << std::setw(12) << tokens
+              << std::setw(12) << size / best << std::setw(14) << std::setprecision(2) << tokens / best / 1e6
+              << std::endl;
+  }
+}
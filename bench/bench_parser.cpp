@@ -0,0 +1,284 @@
+//
+// Measures Parser::program throughput and what the trees it builds cost, per
+// node type, on synthetic programs and on any programs given as files.
+//
+// Usage: bench_parser [megabytes] [repetitions] [file.pas ...]
+//
+
+#include "interpreter.h"
+#include "bench.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Counting allocator: every heap allocation in the process goes through here,
+// so a parse's heap traffic is the difference between two readings. Parsing
+// runs on one thread here, so plain counters do.
+static size_t allocatedBytes = 0;
+static size_t allocationCount = 0;
+
+void* operator new(size_t size) {
+  allocatedBytes += size;
+  allocationCount++;
+  if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+    return memory;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+  std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+  std::free(memory);
+}
+
+namespace {
+
+// Node types in Visitor order.
+enum NodeType {
+  NUM, BOOLEAN, VAR, UNARY_OP, BINARY_OP, PROGRAM, COMPOUND, ASSIGN, NO_OP, BLOCK,
+  VAR_DECL, TYPE, FUNCTION_DECL, PARAM, CALL, NODE_TYPES
+};
+
+const char* const NODE_TYPE_NAMES[NODE_TYPES] = {
+    "Num", "Boolean", "Var", "UnaryOp", "BinaryOp", "Program", "Compound", "Assign", "NoOp", "Block",
+    "VarDecl", "Type", "FunctionDecl", "Param", "Call"
+};
+
+struct NodeCounts {
+  size_t nodes[NODE_TYPES] = {};
+  // The node itself plus the arena arrays of its children.
+  size_t bytes[NODE_TYPES] = {};
+
+  size_t totalNodes() const {
+    size_t total = 0;
+    for (size_t count : nodes) {
+      total += count;
+    }
+    return total;
+  }
+
+  size_t totalBytes() const {
+    size_t total = 0;
+    for (size_t count : bytes) {
+      total += count;
+    }
+    return total;
+  }
+
+  void add(const NodeCounts& other) {
+    for (int type = 0; type < NODE_TYPES; ++type) {
+      nodes[type] += other.nodes[type];
+      bytes[type] += other.bytes[type];
+    }
+  }
+};
+
+// Tallies every distinct node once, so shared subtrees are not counted twice.
+class NodeCounter: public Visitor {
+private:
+  std::unordered_set<const AST*> seen;
+
+  template <typename T>
+  bool count(const T& node, NodeType type, size_t listItems = 0) {
+    if (!seen.insert(&node).second) {
+      return false;
+    }
+    counts.nodes[type]++;
+    counts.bytes[type] += sizeof(T) + listItems * sizeof(AST*);
+    return true;
+  }
+
+  void visitAll(const NodeList& list) {
+    for (AST* item : list) {
+      item->accept(*this);
+    }
+  }
+public:
+  NodeCounts counts;
+
+  void visit(Num& el) override { count(el, NUM); }
+  void visit(Boolean& el) override { count(el, BOOLEAN); }
+  void visit(Var& el) override { count(el, VAR); }
+  void visit(UnaryOp& el) override {
+    if (count(el, UNARY_OP)) {
+      el.node->accept(*this);
+    }
+  }
+  void visit(BinaryOp& el) override {
+    if (count(el, BINARY_OP)) {
+      el.left->accept(*this);
+      el.right->accept(*this);
+    }
+  }
+  void visit(Program& el) override {
+    if (count(el, PROGRAM)) {
+      el.name->accept(*this);
+      el.block->accept(*this);
+    }
+  }
+  void visit(Compound& el) override {
+    if (count(el, COMPOUND, el.children.size())) {
+      visitAll(el.children);
+    }
+  }
+  void visit(Assign& el) override {
+    if (count(el, ASSIGN)) {
+      el.left->accept(*this);
+      el.right->accept(*this);
+    }
+  }
+  void visit(NoOp& el) override { count(el, NO_OP); }
+  void visit(Block& el) override {
+    if (count(el, BLOCK, el.declarations.size())) {
+      visitAll(el.declarations);
+      el.compoundStatement->accept(*this);
+    }
+  }
+  void visit(VarDecl& el) override {
+    if (count(el, VAR_DECL)) {
+      el.var->accept(*this);
+      el.type->accept(*this);
+    }
+  }
+  void visit(Type& el) override { count(el, TYPE); }
+  void visit(FunctionDecl& el) override {
+    if (count(el, FUNCTION_DECL, el.params.size())) {
+      el.name->accept(*this);
+      visitAll(el.params);
+      el.body()->accept(*this);
+    }
+  }
+  void visit(Param& el) override {
+    if (count(el, PARAM)) {
+      el.var->accept(*this);
+      el.type->accept(*this);
+    }
+  }
+  void visit(Call& el) override {
+    if (count(el, CALL, el.actualParams.size())) {
+      el.name->accept(*this);
+      visitAll(el.actualParams);
+    }
+  }
+};
+
+struct Input {
+  std::string name;
+  std::shared_ptr<SourceBuffer> source;
+};
+
+struct Measurement {
+  double seconds = 0;
+  size_t tokens = 0;
+  size_t heapBytes = 0;
+  size_t heapAllocations = 0;
+  size_t arenaBytes = 0;
+  NodeCounts counts;
+};
+
+Measurement measure(const Input& input, int repetitions, bool hashConsing) {
+  Measurement result;
+  result.tokens = tokenize(input.source, std::make_shared<Interner>()).size();
+  result.seconds = bestOf(repetitions, [&](int i) {
+    size_t bytesBefore = allocatedBytes;
+    size_t allocationsBefore = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    Parser parser(input.source);
+    // Programs with errors are still measured, on the tree that recovery builds.
+    auto diagnostics = std::make_shared<Diagnostics>();
+    parser.setDiagnostics(diagnostics);
+    parser.setHashConsing(hashConsing);
+    AST* root = parser.program();
+    double seconds = secondsSince(start);
+    if (i == 0 && !hashConsing && !diagnostics->empty()) {
+      std::cerr << input.name << ": " << diagnostics->size() << " syntax errors" << std::endl;
+    }
+    result.heapBytes = allocatedBytes - bytesBefore;
+    result.heapAllocations = allocationCount - allocationsBefore;
+    if (i == 0) {
+      result.arenaBytes = parser.arena()->bytesUsed();
+      NodeCounter counter;
+      root->accept(counter);
+      result.counts = counter.counts;
+    }
+    return seconds;
+  });
+  return result;
+}
+
+void printNodeTypes(const NodeCounts& counts) {
+  std::cout << std::left << std::setw(14) << "node type" << std::right
+            << std::setw(12) << "nodes" << std::setw(14) << "bytes" << std::setw(12) << "bytes/node"
+            << std::setw(10) << "share" << std::endl;
+  double total = static_cast<double>(counts.totalBytes());
+  for (int type = 0; type < NODE_TYPES; ++type) {
+    if (counts.nodes[type] == 0) {
+      continue;
+    }
+    std::cout << std::left << std::setw(14) << NODE_TYPE_NAMES[type] << std::right << std::fixed
+              << std::setw(12) << counts.nodes[type] << std::setw(14) << counts.bytes[type]
+              << std::setw(12) << std::setprecision(1) << static_cast<double>(counts.bytes[type]) / counts.nodes[type]
+              << std::setw(9) << 100 * counts.bytes[type] / total << "%" << std::endl;
+  }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8;
+  int repetitions = argc > 2 ? std::atoi(argv[2]) : 3;
+  warnIfUnoptimized();
+
+  std::vector<Input> inputs;
+  for (ProgramShape shape : allProgramShapes()) {
+    inputs.push_back({shapeName(shape), SourceBuffer::fromString(generateProgram(shape, megabytes << 20))});
+  }
+  for (int i = 3; i < argc; ++i) {
+    inputs.push_back({argv[i], SourceBuffer::fromFile(argv[i])});
+  }
+
+  for (bool hashConsing : {false, true}) {
+    std::cout << (hashConsing ? "\nhash consing\n" : "tree\n");
+    std::cout << std::left << std::setw(16) << "input" << std::right
+              << std::setw(8) << "MB" << std::setw(12) << "tokens" << std::setw(12) << "nodes"
+              << std::setw(12) << "Mtokens/s" << std::setw(11) << "Mnodes/s"
+              << std::setw(12) << "arena MB" << std::setw(11) << "heap MB" << std::setw(10) << "allocs"
+              << std::setw(12) << "bytes/node" << std::endl;
+    NodeCounts all;
+    for (const Input& input : inputs) {
+      Measurement result = measure(input, repetitions, hashConsing);
+      size_t nodes = result.counts.totalNodes();
+      all.add(result.counts);
+      std::cout << std::left << std::setw(16) << input.name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(8) << static_cast<double>(input.source->size()) / (1 << 20)
+                << std::setw(12) << result.tokens << std::setw(12) << nodes << std::setprecision(2)
+                << std::setw(12) << result.tokens / result.seconds / 1e6
+                << std::setw(11) << nodes / result.seconds / 1e6
+                << std::setw(12) << static_cast<double>(result.arenaBytes) / (1 << 20)
+                << std::setw(11) << static_cast<double>(result.heapBytes) / (1 << 20)
+                << std::setw(10) << result.heapAllocations << std::setprecision(1)
+                << std::setw(12) << static_cast<double>(result.counts.totalBytes()) / nodes << std::endl;
+    }
+    std::cout << std::endl;
+    printNodeTypes(all);
+  }
+}
@@ -0,0 +1,46 @@
+//
+// Measures how tokenizeParallel scales with the number of threads.
+//
+// Usage: bench_tokenize [megabytes] [max threads]
+//
+
+#include "interpreter.h"
+#include "bench.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+double secondsFor(const std::shared_ptr<SourceBuffer>& source, unsigned threads, size_t& count) {
+  auto start = std::chrono::steady_clock::now();
+  auto symbols = std::make_shared<Interner>();
+  count = threads == 0 ? tokenize(source, symbols).size() : tokenizeParallel(source, symbols, threads).size();
+  return secondsSince(start);
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+  unsigned maxThreads = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : std::thread::hardware_concurrency();
+  if (maxThreads == 0) {
+    maxThreads = 1;
+  }
+  warnIfUnoptimized();
+
+  auto source = SourceBuffer::fromString(generateProgram(ProgramShape::MIXED, megabytes << 20));
+  double size = static_cast<double>(source->size()) / (1 << 20);
+
+  size_t count = 0;
+  double serial = secondsFor(source, 0, count);
+  std::cout << "source: " << size << " MB, " << count << " tokens" << std::endl;
+  std::cout << "serial: " << serial << " s, " << size / serial << " MB/s" << std::endl;
+
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+    double parallel = secondsFor(source, threads, count);
+    std::cout << threads << " threads: " << parallel << " s, " << size / parallel << " MB/s, "
+              << serial / parallel << "x serial" << std::endl;
+  }
+}
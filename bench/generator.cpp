@@ -0,0 +1,209 @@
+#include "bench.h"
+
+namespace {
+
+const char* const WORDS[] = {
+    "account", "balance", "counter", "delta", "element", "factor", "gradient", "height",
+    "index", "journal", "kernel", "length", "measure", "number", "offset", "position",
+    "quantity", "result", "summary", "total", "update", "value", "weight", "extent"
+};
+const size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+const char* const BINARY_OPERATORS[] = {"+", "-", "*", "/", "<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+const size_t BINARY_OPERATOR_COUNT = sizeof(BINARY_OPERATORS) / sizeof(BINARY_OPERATORS[0]);
+
+class Generator {
+private:
+  std::string text;
+  unsigned seed;
+
+  unsigned next(unsigned bound) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) % bound;
+  }
+
+  void indent(int depth) {
+    text.append(static_cast<size_t>(depth) * 4, ' ');
+  }
+
+  void shortName() {
+    text += static_cast<char>('a' + next(26));
+  }
+
+  void longName() {
+    text += WORDS[next(WORD_COUNT)];
+    const char* second = WORDS[next(WORD_COUNT)];
+    text += static_cast<char>(second[0] - 'a' + 'A');
+    text += second + 1;
+    text += std::to_string(next(100));
+  }
+
+  void denseExpression(int terms) {
+    for (int i = 0; i < terms; ++i) {
+      if (i > 0) {
+        text += BINARY_OPERATORS[next(BINARY_OPERATOR_COUNT)];
+      }
+      switch (next(4)) {
+        case 0:
+          text += std::to_string(next(1000));
+          break;
+        case 1:
+          text += "!";
+          shortName();
+          break;
+        case 2:
+          text += "(";
+          shortName();
+          text += "+";
+          text += std::to_string(next(10));
+          text += ")";
+          break;
+        default:
+          shortName();
+          break;
+      }
+    }
+  }
+
+  void nestedExpression(int depth) {
+    if (depth == 0) {
+      longName();
+      return;
+    }
+    text += "(";
+    nestedExpression(depth - 1);
+    text += " * ";
+    text += std::to_string(next(100));
+    text += ")";
+  }
+
+  void identifierStatement(int depth) {
+    indent(depth);
+    longName();
+    text += " := ";
+    longName();
+    text += " + ";
+    longName();
+  }
+
+  void operatorStatement(int depth) {
+    indent(depth);
+    shortName();
+    text += ":=";
+    denseExpression(12);
+  }
+
+  void commentedStatement(int depth) {
+    indent(depth + 4);
+    text += "{ ---------------------------------------------------------------\n";
+    for (unsigned line = 0, lines = 2 + next(6); line < lines; ++line) {
+      indent(depth + 4);
+      text += "  ";
+      for (unsigned word = 0; word < 8; ++word) {
+        text += WORDS[next(WORD_COUNT)];
+        text += ' ';
+      }
+      text += "\n";
+    }
+    indent(depth + 4);
+    text += "--------------------------------------------------------------- }\n";
+    indent(depth + 4);
+    shortName();
+    text += " := ";
+    shortName();
+    text += " + 1";
+  }
+
+  void nestedStatement(int depth, int levels) {
+    if (levels <= 0) {
+      indent(depth);
+      shortName();
+      text += " := ";
+      nestedExpression(16);
+      return;
+    }
+    indent(depth);
+    text += "BEGIN\n";
+    nestedStatement(depth + 1, levels - 1);
+    text += ";\n";
+    nestedStatement(depth + 1, levels - 1 - static_cast<int>(next(2)));
+    text += "\n";
+    indent(depth);
+    text += "END";
+  }
+
+  void statement(ProgramShape shape) {
+    switch (shape) {
+      case ProgramShape::IDENTIFIERS:
+        identifierStatement(1);
+        break;
+      case ProgramShape::OPERATORS:
+        operatorStatement(1);
+        break;
+      case ProgramShape::COMMENTS:
+        commentedStatement(1);
+        break;
+      case ProgramShape::NESTED:
+        nestedStatement(1, 8);
+        break;
+      case ProgramShape::MIXED:
+        statement(static_cast<ProgramShape>(next(4)));
+        break;
+    }
+  }
+
+public:
+  explicit Generator(unsigned seed): seed(seed) {}
+
+  std::string program(ProgramShape shape, size_t bytes) {
+    text.reserve(bytes + 4096);
+    text += "PROGRAM generated;\n";
+    text += "{ Generated ";
+    text += shapeName(shape);
+    text += " program }\n";
+    if (shape == ProgramShape::MIXED) {
+      for (int i = 0; i < 4; ++i) {
+        text += "FUNCTION helper" + std::to_string(i) + ";\nBEGIN\n";
+        statement(shape);
+        text += "\nEND;\n";
+      }
+    }
+    text += "BEGIN\n";
+    while (text.size() < bytes) {
+      statement(shape);
+      text += ";\n";
+    }
+    text += "    done := 0\nEND.\n";
+    return std::move(text);
+  }
+};
+
+}
+
+const std::vector<ProgramShape>& allProgramShapes() {
+  static const std::vector<ProgramShape> shapes = {
+      ProgramShape::IDENTIFIERS, ProgramShape::OPERATORS, ProgramShape::COMMENTS,
+      ProgramShape::NESTED, ProgramShape::MIXED
+  };
+  return shapes;
+}
+
+const char* shapeName(ProgramShape shape) {
+  switch (shape) {
+    case ProgramShape::IDENTIFIERS:
+      return "identifiers";
+    case ProgramShape::OPERATORS:
+      return "operators";
+    case ProgramShape::COMMENTS:
+      return "comments";
+    case ProgramShape::NESTED:
+      return "nested";
+    case ProgramShape::MIXED:
+      return "mixed";
+  }
+  return "unknown";
+}
+
+std::string generateProgram(ProgramShape shape, size_t bytes, unsigned seed) {
+  return Generator(seed).program(shape, bytes);
+}
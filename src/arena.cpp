@@ -0,0 +1,35 @@
+#include "arena.h"
+
+// Starts a new block. Requests over a quarter of a block get a block of their
+// own instead, and the current block stays in use for the requests after them.
+void* Arena::allocateSlow(size_t size, size_t alignment) {
+  size_t needed = size + alignment - 1;
+  if (needed > blockSize / 4) {
+    blocks.emplace_back(new char[needed]);
+    reserved += needed;
+    used += size;
+    uintptr_t at = (reinterpret_cast<uintptr_t>(blocks.back().get()) + alignment - 1) & ~(alignment - 1);
+    return reinterpret_cast<void*>(at);
+  }
+  blocks.emplace_back(new char[blockSize]);
+  reserved += blockSize;
+  next = blocks.back().get();
+  limit = next + blockSize;
+  return allocate(size, alignment);
+}
+
+size_t Arena::bytesUsed() const {
+  size_t total = used;
+  for (const auto& arena : adopted) {
+    total += arena->bytesUsed();
+  }
+  return total;
+}
+
+size_t Arena::bytesReserved() const {
+  size_t total = reserved;
+  for (const auto& arena : adopted) {
+    total += arena->bytesReserved();
+  }
+  return total;
+}
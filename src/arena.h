@@ -0,0 +1,87 @@
+//
+// Bump allocator for objects that all die together, such as the AST of one program.
+//
+
+#ifndef PROGRAM_ARENA_H
+#define PROGRAM_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Hands out memory from large blocks and frees the blocks all at once when it
+// is destroyed. Objects are never destroyed one by one, so only trivially
+// destructible types may live in an arena.
+class Arena {
+private:
+  std::vector<std::unique_ptr<char[]>> blocks;
+  char* next = nullptr;
+  char* limit = nullptr;
+  size_t blockSize;
+  size_t used = 0;
+  size_t reserved = 0;
+  std::vector<std::shared_ptr<Arena>> adopted;
+
+  void* allocateSlow(size_t size, size_t alignment);
+public:
+  static const size_t BLOCK_SIZE = 64 * 1024;
+
+  explicit Arena(size_t blockSize = BLOCK_SIZE): blockSize(blockSize) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // alignment has to be a power of two.
+  void* allocate(size_t size, size_t alignment) {
+    uintptr_t at = (reinterpret_cast<uintptr_t>(next) + alignment - 1) & ~(alignment - 1);
+    if (at + size > reinterpret_cast<uintptr_t>(limit)) {
+      return allocateSlow(size, alignment);
+    }
+    next = reinterpret_cast<char*>(at + size);
+    used += size;
+    return reinterpret_cast<void*>(at);
+  }
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed.");
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // Keeps another arena alive as long as this one, for objects that point into both.
+  void adopt(std::shared_ptr<Arena> other) { adopted.push_back(std::move(other)); }
+
+  // Bytes handed out so far, not counting alignment padding or unused block
+  // space. Both counts include adopted arenas.
+  size_t bytesUsed() const;
+  // Bytes of blocks taken from the heap.
+  size_t bytesReserved() const;
+};
+
+// A fixed-size array whose elements live in an arena.
+template <typename T>
+class ArenaArray {
+private:
+  T* items = nullptr;
+  size_t count = 0;
+public:
+  ArenaArray() = default;
+  ArenaArray(Arena& arena, const T* from, size_t count): count(count) {
+    static_assert(std::is_trivially_copyable<T>::value, "Arena arrays are copied bytewise.");
+    if (count > 0) {
+      items = static_cast<T*>(arena.allocate(count * sizeof(T), alignof(T)));
+      std::uninitialized_copy(from, from + count, items);
+    }
+  }
+
+  T* begin() const { return items; }
+  T* end() const { return items + count; }
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T& operator[](size_t i) const { return items[i]; }
+};
+
+#endif //PROGRAM_ARENA_H
@@ -0,0 +1,225 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <utility>
+#include "interpreter.h"
+
+// File layout: the header, then nodeCount values, nodeCount + 1 child starts,
+// childCount children, symbolCount + 1 offsets into the names, nodeCount kinds,
+// nodeCount ops, and the names themselves. Symbols are numbered by position.
+struct AstCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  uint64_t sourceHash;
+  uint64_t nodeCount;
+  uint64_t childCount;
+  uint64_t symbolCount;
+  uint64_t namesSize;
+};
+
+static const char AST_CACHE_MAGIC[4] = {'P', 'A', 'S', 'T'};
+
+static_assert(sizeof(FlatTree::Kind) == 1 && sizeof(Token::Type) == 1, "Kinds and ops are stored as single bytes.");
+
+// Copies count items out of the file at offset and moves offset past them.
+template <typename T>
+static void readArray(const SourceBuffer& file, size_t& offset, std::vector<T>& items, size_t count) {
+  items.resize(count);
+  if (count > 0) {
+    std::memcpy(items.data(), file.begin() + offset, count * sizeof(T));
+  }
+  offset += count * sizeof(T);
+}
+
+template <typename T>
+static void writeArray(std::ofstream& out, const std::vector<T>& items) {
+  out.write(reinterpret_cast<const char*>(items.data()), static_cast<std::streamsize>(items.size() * sizeof(T)));
+}
+
+// The interpreters index children by position, so a node has to have as many
+// as its kind reads, all of them later in pre-order.
+static bool wellFormed(const FlatTree& tree, size_t symbolCount) {
+  if (tree.childStart.front() != 0 || tree.childStart.back() != tree.children.size()) {
+    return false;
+  }
+  for (FlatTree::Index node = 0; node < tree.size(); ++node) {
+    if (tree.childStart[node] > tree.childStart[node + 1]) {
+      return false;
+    }
+    size_t count = tree.childCount(node);
+    switch (tree.kinds[node]) {
+      case FlatTree::NUM:
+      case FlatTree::BOOLEAN:
+      case FlatTree::NO_OP:
+      case FlatTree::TYPE:
+        if (count != 0) {
+          return false;
+        }
+        break;
+      case FlatTree::VAR:
+        if (count != 0 || tree.values[node] < 0 || static_cast<uint64_t>(tree.values[node]) >= symbolCount) {
+          return false;
+        }
+        break;
+      case FlatTree::UNARY_OP:
+        if (count != 1) {
+          return false;
+        }
+        break;
+      case FlatTree::BINARY_OP:
+      case FlatTree::PROGRAM:
+      case FlatTree::ASSIGN:
+      case FlatTree::VAR_DECL:
+      case FlatTree::PARAM:
+        if (count != 2) {
+          return false;
+        }
+        break;
+      case FlatTree::BLOCK:
+      case FlatTree::CALL:
+        if (count < 1) {
+          return false;
+        }
+        break;
+      case FlatTree::FUNCTION_DECL:
+        if (count < 2) {
+          return false;
+        }
+        break;
+      case FlatTree::COMPOUND:
+        break;
+      default:
+        return false;
+    }
+    for (const FlatTree::Index* child = tree.childrenBegin(node); child != tree.childrenEnd(node); ++child) {
+      if (*child <= node || *child >= tree.size()) {
+        return false;
+      }
+    }
+  }
+  return tree.size() > 0 && tree.kinds[0] == FlatTree::PROGRAM;
+}
+
+std::shared_ptr<AstCache> AstCache::load(const std::string& path, const SourceBuffer& source) {
+  return load(path, source.size(), TokenCache::hash(source));
+}
+
+std::shared_ptr<AstCache> AstCache::load(const std::string& path, size_t sourceSize, uint64_t sourceHash) {
+  std::shared_ptr<SourceBuffer> file;
+  try {
+    file = SourceBuffer::fromFile(path);
+  } catch (const std::invalid_argument&) {
+    return nullptr;
+  }
+  AstCacheHeader header {};
+  if (file->size() < sizeof(header)) {
+    return nullptr;
+  }
+  std::memcpy(&header, file->begin(), sizeof(header));
+  if (std::memcmp(header.magic, AST_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION ||
+      header.sourceSize != sourceSize || header.sourceHash != sourceHash) {
+    return nullptr;
+  }
+  if (header.nodeCount >= file->size() / sizeof(int64_t) || header.childCount >= file->size() / sizeof(FlatTree::Index) ||
+      header.symbolCount >= file->size() / sizeof(uint32_t) || header.namesSize > file->size()) {
+    return nullptr;
+  }
+  size_t namesAt = sizeof(header) + header.nodeCount * (sizeof(int64_t) + sizeof(FlatTree::Index) + 2) +
+      sizeof(FlatTree::Index) + header.childCount * sizeof(FlatTree::Index) + (header.symbolCount + 1) * sizeof(uint32_t);
+  if (namesAt + header.namesSize != file->size()) {
+    return nullptr;
+  }
+
+  auto cache = std::shared_ptr<AstCache>(new AstCache);
+  FlatTree& tree = cache->tree;
+  std::vector<uint32_t> offsets;
+  size_t at = sizeof(header);
+  readArray(*file, at, tree.values, header.nodeCount);
+  readArray(*file, at, tree.childStart, header.nodeCount + 1);
+  readArray(*file, at, tree.children, header.childCount);
+  readArray(*file, at, offsets, header.symbolCount + 1);
+  readArray(*file, at, tree.kinds, header.nodeCount);
+  readArray(*file, at, tree.ops, header.nodeCount);
+  if (!wellFormed(tree, header.symbolCount)) {
+    return nullptr;
+  }
+
+  cache->symbols = std::make_shared<Interner>();
+  const char* names = file->begin() + namesAt;
+  for (uint64_t symbol = 0; symbol < header.symbolCount; ++symbol) {
+    uint32_t from = offsets[symbol];
+    uint32_t to = offsets[symbol + 1];
+    if (to < from || to > header.namesSize || cache->symbols->intern(names + from, to - from) != symbol) {
+      return nullptr;
+    }
+  }
+  return cache;
+}
+
+bool AstCache::save(const std::string& path, const SourceBuffer& source, const FlatTree& tree, const Interner& symbols) {
+  AstCacheHeader header {};
+  std::memcpy(header.magic, AST_CACHE_MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.sourceSize = source.size();
+  header.sourceHash = TokenCache::hash(source);
+  header.nodeCount = tree.size();
+  header.childCount = tree.children.size();
+  header.symbolCount = symbols.size();
+  std::vector<uint32_t> offsets = {0};
+  for (Symbol symbol = 0; symbol < symbols.size(); ++symbol) {
+    header.namesSize += symbols.name(symbol).size();
+    offsets.push_back(static_cast<uint32_t>(header.namesSize));
+  }
+
+  // Written next to the target and renamed over it, like TokenCache::save().
+  std::string temporary = path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(out, tree.values);
+    writeArray(out, tree.childStart);
+    writeArray(out, tree.children);
+    writeArray(out, offsets);
+    writeArray(out, tree.kinds);
+    writeArray(out, tree.ops);
+    for (Symbol symbol = 0; symbol < symbols.size(); ++symbol) {
+      out.write(symbols.name(symbol).data(), static_cast<std::streamsize>(symbols.name(symbol).size()));
+    }
+    if (!out.flush()) {
+      out.close();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<AstCache> AstCache::open(const std::string& directory, const SourceBuffer& source) {
+  uint64_t sourceHash = TokenCache::hash(source);
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.ast", static_cast<unsigned long long>(sourceHash));
+  std::string path = directory + "/" + name;
+  if (auto cache = load(path, source.size(), sourceHash)) {
+    return cache;
+  }
+
+  Parser parser(SourceBuffer::fromView(source.begin(), source.size()));
+  auto diagnostics = std::make_shared<Diagnostics>();
+  parser.setDiagnostics(diagnostics);
+  // Builds the recursive parser's tree without overflowing on deep nesting.
+  parser.setIterative(true);
+  AST* root = parser.program();
+  if (!diagnostics->empty()) {
+    return nullptr;
+  }
+  if (!save(path, source, FlatTree::fromTree(*root), *parser.interner())) {
+    return nullptr;
+  }
+  return load(path, source.size(), sourceHash);
+}
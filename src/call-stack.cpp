@@ -3,6 +3,7 @@
 //
 
 #include <utility>
+#include <algorithm>
 
 #include "interpreter.h"
 
@@ -16,33 +17,59 @@ class ValuePrinter : public RecordValueVisitor {
   void visit(ASTValue& el) override {
     std::cout << "AST" << std::endl;
   }
+  void visit(FlatFunctionValue&) override {
+    std::cout << "AST" << std::endl;
+  }
 };
 
-void ActivationRecord::print() {
+void ActivationRecord::print(const Interner& symbols) {
   ValuePrinter printer;
-  for(const auto & item : members) {
-    std::cout << item.first << " ";
+  std::vector<std::pair<const std::string*, RecordValue*>> sorted;
+  for (Symbol symbol = 0; symbol < members.size(); ++symbol) {
+    if (members[symbol] != nullptr) {
+      sorted.emplace_back(&symbols.name(symbol), members[symbol].get());
+    }
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const std::pair<const std::string*, RecordValue*>& a, const std::pair<const std::string*, RecordValue*>& b) {
+    return *a.first < *b.first;
+  });
+  for(const auto & item : sorted) {
+    std::cout << *item.first << " ";
     item.second->accept(printer);
 //    std::cout << item.first << " " << item.second << std::endl;
   }
 }
 
-std::shared_ptr<RecordValue> ActivationRecord::get(std::string name) {
+std::shared_ptr<RecordValue> ActivationRecord::get(Symbol name) {
   // TODO: error if not found
-  if (members.find(name) == members.end() && parent != nullptr) {
-    parent->get(name);
+  if (name < members.size() && members[name] != nullptr) {
+    return members[name];
   }
-  return members[name];
+  if (parent != nullptr) {
+    return parent->get(name);
+  }
+  return nullptr;
+}
+
+void ActivationRecord::set(Symbol name, bool value) {
+  slot(name) = std::shared_ptr<RecordValue>(new BooleanValue(value));
+}
+
+void ActivationRecord::set(Symbol name, int64_t value) {
+  slot(name) = std::shared_ptr<RecordValue>(new NumberValue(value));
 }
 
-void ActivationRecord::set(std::string name, bool value) {
-  members[name] = std::shared_ptr<RecordValue>(new BooleanValue(value));
+void ActivationRecord::set(Symbol name, FunctionDecl value) {
+  slot(name) = std::shared_ptr<RecordValue>(new ASTValue(value));
 }
 
-void ActivationRecord::set(std::string name, int value) {
-  members[name] = std::shared_ptr<RecordValue>(new NumberValue(value));
+void ActivationRecord::set(Symbol name, std::shared_ptr<RecordValue> value) {
+  slot(name) = std::move(value);
 }
 
-void ActivationRecord::set(std::string name, FunctionDecl value) {
-  members[name] = std::shared_ptr<RecordValue>(new ASTValue(value));
-}
\ No newline at end of file
+std::shared_ptr<RecordValue>& ActivationRecord::slot(Symbol name) {
+  if (name >= members.size()) {
+    members.resize(name + 1);
+  }
+  return members[name];
+}
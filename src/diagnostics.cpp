@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cstring>
+#include "interpreter.h"
+
+const char* diagnosticMessage(DiagnosticCode code) {
+  switch (code) {
+    case DiagnosticCode::INVALID_CHARACTER: return "Invalid character";
+    case DiagnosticCode::INVALID_OPERATOR: return "Invalid operator";
+    case DiagnosticCode::UNTERMINATED_COMMENT: return "Unterminated comment";
+    case DiagnosticCode::INTEGER_OUT_OF_RANGE: return "Integer literal out of range";
+    case DiagnosticCode::TOKEN_TOO_LONG: return "Token longer than 65535 characters";
+    case DiagnosticCode::UNEXPECTED_TOKEN: return "Unexpected token";
+    case DiagnosticCode::EXPECTED_EXPRESSION: return "Expected an expression";
+    case DiagnosticCode::EXPECTED_TYPE: return "Expected a type";
+    case DiagnosticCode::NESTING_TOO_DEEP: return "Nesting too deep";
+  }
+  return "Error";
+}
+
+void Diagnostics::addLines(const char* text, size_t length) {
+  const char* end = text + length;
+  for (const char* c = text; (c = static_cast<const char*>(std::memchr(c, '\n', end - c))) != nullptr; ++c) {
+    lineStarts.push_back(static_cast<uint32_t>(scanned + (c - text) + 1));
+  }
+  scanned += length;
+}
+
+void Diagnostics::merge(const Diagnostics& other) {
+  entries.insert(entries.end(), other.entries.begin(), other.entries.end());
+  std::stable_sort(entries.begin(), entries.end(), [](const Diagnostic& a, const Diagnostic& b) {
+    return a.offset < b.offset;
+  });
+}
+
+Diagnostics::Position Diagnostics::position(size_t offset) const {
+  if (!hasLines() || offset > scanned) {
+    return {0, 0};
+  }
+  auto after = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+  size_t lineStart = after == lineStarts.begin() ? 0 : after[-1];
+  return {static_cast<uint32_t>(after - lineStarts.begin() + 1), static_cast<uint32_t>(offset - lineStart + 1)};
+}
+
+void Diagnostics::print(std::ostream& out, const std::string& name) const {
+  for (const auto& diagnostic : entries) {
+    Position at = position(diagnostic.offset);
+    out << name << ":";
+    if (at.line == 0) {
+      out << "offset " << diagnostic.offset;
+    } else {
+      out << at.line << ":" << at.column;
+    }
+    out << ": " << diagnosticMessage(diagnostic.code);
+    if (diagnostic.code == DiagnosticCode::UNEXPECTED_TOKEN) {
+      out << ": expected " << tokenName(diagnostic.expected) << ", found " << tokenName(diagnostic.found);
+    }
+    out << std::endl;
+  }
+}
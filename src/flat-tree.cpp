@@ -0,0 +1,308 @@
+#include <cstring>
+#include <utility>
+#include "interpreter.h"
+
+namespace {
+
+// Appends each node when it is entered, so nodes end up in pre-order, and
+// reserves its children's slots right away so every node's range of children
+// starts where the previous node's range ends.
+class FlatBuilder : public Visitor {
+private:
+  FlatTree& tree;
+  // Index of the node the last accept() appended.
+  FlatTree::Index last = 0;
+  // Operators and compound statements nest deeper than the call stack
+  // allows, so they are appended with a stack of the open ones instead of
+  // recursion, each with the index of its next child.
+  struct Nested {
+    AST* node;
+    FlatTree::Kind kind;
+    FlatTree::Index index;
+    size_t next;
+  };
+  std::vector<Nested> nested;
+
+  FlatTree::Index open(FlatTree::Kind kind, size_t childCount, Token::Type op = Token::Type::END_OF_FILE, int64_t value = 0) {
+    auto index = static_cast<FlatTree::Index>(tree.kinds.size());
+    tree.kinds.push_back(kind);
+    tree.ops.push_back(op);
+    tree.values.push_back(value);
+    tree.childStart.push_back(static_cast<FlatTree::Index>(tree.children.size()));
+    tree.children.resize(tree.children.size() + childCount);
+    last = index;
+    return index;
+  }
+
+  void fill(FlatTree::Index node, size_t i, AST* child) {
+    child->accept(*this);
+    tree.children[tree.childStart[node] + i] = last;
+  }
+
+  void fill(FlatTree::Index node, size_t from, const NodeList& list) {
+    for (size_t i = 0; i < list.size(); ++i) {
+      fill(node, from + i, list[i]);
+    }
+  }
+
+  // Appends node and pushes it on nested if it is an operator or a compound statement.
+  bool openNested(AST* node) {
+    if (auto op = dynamic_cast<UnaryOp*>(node)) {
+      nested.push_back({node, FlatTree::UNARY_OP, open(FlatTree::UNARY_OP, 1, op->op.type), 0});
+    } else if (auto op = dynamic_cast<BinaryOp*>(node)) {
+      nested.push_back({node, FlatTree::BINARY_OP, open(FlatTree::BINARY_OP, 2, op->op.type), 0});
+    } else if (auto compound = dynamic_cast<Compound*>(node)) {
+      nested.push_back({node, FlatTree::COMPOUND, open(FlatTree::COMPOUND, compound->children.size()), 0});
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // The next child of an open node, or null after the last.
+  static AST* nextChild(Nested& parent) {
+    size_t i = parent.next++;
+    switch (parent.kind) {
+      case FlatTree::UNARY_OP:
+        return i == 0 ? static_cast<UnaryOp*>(parent.node)->node : nullptr;
+      case FlatTree::BINARY_OP:
+        return i == 0 ? static_cast<BinaryOp*>(parent.node)->left : i == 1 ? static_cast<BinaryOp*>(parent.node)->right : nullptr;
+      default: {
+        auto& children = static_cast<Compound*>(parent.node)->children;
+        return i < children.size() ? children[i] : nullptr;
+      }
+    }
+  }
+
+  // Pre-order like the recursive visits: every node is appended before its children.
+  void appendNested(AST& root) {
+    size_t base = nested.size();
+    openNested(&root);
+    FlatTree::Index rootIndex = nested.back().index;
+    while (nested.size() > base) {
+      FlatTree::Index parent = nested.back().index;
+      size_t i = nested.back().next;
+      AST* child = nextChild(nested.back());
+      if (child == nullptr) {
+        nested.pop_back();
+      } else if (openNested(child)) {
+        tree.children[tree.childStart[parent] + i] = nested.back().index;
+      } else {
+        fill(parent, i, child);
+      }
+    }
+    last = rootIndex;
+  }
+
+public:
+  explicit FlatBuilder(FlatTree& tree): tree(tree) {}
+
+  void visit(Num& el) override {
+    open(FlatTree::NUM, 0, Token::Type::END_OF_FILE, el.value);
+  }
+  void visit(Boolean& el) override {
+    open(FlatTree::BOOLEAN, 0, Token::Type::END_OF_FILE, el.value ? 1 : 0);
+  }
+  void visit(Var& el) override {
+    open(FlatTree::VAR, 0, Token::Type::END_OF_FILE, el.symbol);
+  }
+  void visit(UnaryOp& el) override {
+    appendNested(el);
+  }
+  void visit(BinaryOp& el) override {
+    appendNested(el);
+  }
+  void visit(Program& el) override {
+    auto node = open(FlatTree::PROGRAM, 2);
+    fill(node, 0, el.name);
+    fill(node, 1, el.block);
+    last = node;
+  }
+  void visit(Compound& el) override {
+    appendNested(el);
+  }
+  void visit(Block& el) override {
+    auto node = open(FlatTree::BLOCK, el.declarations.size() + 1);
+    fill(node, 0, el.declarations);
+    fill(node, el.declarations.size(), el.compoundStatement);
+    last = node;
+  }
+  void visit(Assign& el) override {
+    auto node = open(FlatTree::ASSIGN, 2);
+    fill(node, 0, el.left);
+    fill(node, 1, el.right);
+    last = node;
+  }
+  void visit(NoOp&) override {
+    open(FlatTree::NO_OP, 0);
+  }
+  void visit(VarDecl& el) override {
+    auto node = open(FlatTree::VAR_DECL, 2);
+    fill(node, 0, el.var);
+    fill(node, 1, el.type);
+    last = node;
+  }
+  void visit(Type& el) override {
+    open(FlatTree::TYPE, 0, keywordType(el.name, std::strlen(el.name)));
+  }
+  void visit(Param& el) override {
+    auto node = open(FlatTree::PARAM, 2);
+    fill(node, 0, el.var);
+    fill(node, 1, el.type);
+    last = node;
+  }
+  void visit(FunctionDecl& el) override {
+    auto node = open(FlatTree::FUNCTION_DECL, el.params.size() + 2);
+    fill(node, 0, el.name);
+    fill(node, 1, el.params);
+    fill(node, el.params.size() + 1, el.body());
+    last = node;
+  }
+  void visit(Call& el) override {
+    auto node = open(FlatTree::CALL, el.actualParams.size() + 1);
+    fill(node, 0, el.name);
+    fill(node, 1, el.actualParams);
+    last = node;
+  }
+};
+
+}
+
+FlatTree FlatTree::fromTree(AST& root) {
+  FlatTree tree;
+  FlatBuilder builder(tree);
+  root.accept(builder);
+  tree.childStart.push_back(static_cast<Index>(tree.children.size()));
+  return tree;
+}
+
+void FlatInterpreter::runProgram(const FlatTree& program) {
+  run(program, 0);
+}
+
+void FlatInterpreter::run(const FlatTree& program, FlatTree::Index node) {
+  tree = &program;
+  run(node);
+}
+
+// Mirrors PrintVisitor node for node.
+void FlatInterpreter::run(FlatTree::Index node) {
+  switch (tree->kinds[node]) {
+    case FlatTree::NUM:
+    case FlatTree::BOOLEAN:
+      value = tree->values[node];
+      break;
+    case FlatTree::VAR:
+      name = static_cast<Symbol>(tree->values[node]);
+      if (callstack != nullptr) {
+        auto ar = callstack->get(name);
+        if (ar != nullptr) {
+          ar->accept(*this);
+        }
+      }
+      break;
+    case FlatTree::UNARY_OP:
+    case FlatTree::BINARY_OP:
+      evaluate(node);
+      break;
+    case FlatTree::PROGRAM:
+      run(tree->child(node, 0));
+      callstack = std::make_shared<ActivationRecord>(name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+      run(tree->child(node, 1));
+      callstack->print(*symbols);
+      callstack = nullptr;
+      break;
+    case FlatTree::COMPOUND:
+      runStatements(node);
+      break;
+    case FlatTree::BLOCK:
+      for (const FlatTree::Index* child = tree->childrenBegin(node); child != tree->childrenEnd(node); ++child) {
+        run(*child);
+      }
+      break;
+    case FlatTree::ASSIGN: {
+      run(tree->child(node, 0));
+      Symbol varName = name;
+      run(tree->child(node, 1));
+      callstack->set(varName, value);
+      break;
+    }
+    case FlatTree::NO_OP:
+    case FlatTree::VAR_DECL:
+    case FlatTree::TYPE:
+    case FlatTree::PARAM:
+      break;
+    case FlatTree::FUNCTION_DECL:
+      run(tree->child(node, 0));
+      callstack->set(name, std::make_shared<FlatFunctionValue>(tree, node));
+      break;
+    case FlatTree::CALL: {
+      run(tree->child(node, 0));
+      auto function = callstack->get(name);
+      if (function == nullptr) {
+        throw std::invalid_argument("Undefined function " + symbols->name(name) + ".");
+      }
+      callstack = std::make_shared<ActivationRecord>(name, ActivationRecord::Type::FUNCTION, callstack->level, callstack);
+      function->accept(*this);
+      callstack->print(*symbols);
+      callstack = callstack->parent;
+      break;
+    }
+  }
+}
+
+// As PrintVisitor::evaluate().
+void FlatInterpreter::evaluate(FlatTree::Index expression) {
+  typedef PendingOperator<FlatTree::Index> Pending;
+  size_t base = operators.size();
+  FlatTree::Index node = expression;
+  while (true) {
+    while (true) {
+      if (tree->kinds[node] == FlatTree::UNARY_OP) {
+        operators.push_back({Pending::UNARY, tree->ops[node], 0, 0});
+        node = tree->child(node, 0);
+      } else if (tree->kinds[node] == FlatTree::BINARY_OP) {
+        operators.push_back({Pending::LEFT, tree->ops[node], tree->child(node, 1), 0});
+        node = tree->child(node, 0);
+      } else {
+        break;
+      }
+    }
+    run(node);
+    bool operand = false;
+    while (!operand) {
+      if (operators.size() == base) {
+        return;
+      }
+      auto& pending = operators.back();
+      if (pending.stage == Pending::LEFT) {
+        pending.stage = Pending::RIGHT;
+        pending.left = value;
+        node = pending.right;
+        operand = true;
+      } else {
+        value = pending.stage == Pending::UNARY ? unaryOpValue(pending.op, value) : binaryOpValue(pending.op, pending.left, value);
+        operators.pop_back();
+      }
+    }
+  }
+}
+
+// As PrintVisitor::runStatements().
+void FlatInterpreter::runStatements(FlatTree::Index compound) {
+  size_t base = statements.size();
+  statements.push_back({compound, 0});
+  while (statements.size() > base) {
+    auto& pending = statements.back();
+    if (pending.next == tree->childCount(pending.compound)) {
+      statements.pop_back();
+      continue;
+    }
+    FlatTree::Index statement = tree->child(pending.compound, pending.next++);
+    if (tree->kinds[statement] == FlatTree::COMPOUND) {
+      statements.push_back({statement, 0});
+    } else {
+      run(statement);
+    }
+  }
+}
@@ -1,15 +1,30 @@
 #include "interpreter.h"
 
-bool isDigit(const char &value) {
-  return
-      value == '0' ||
-      value == '1' ||
-      value == '2' ||
-      value == '3' ||
-      value == '4' ||
-      value == '5' ||
-      value == '6' ||
-      value == '7' ||
-      value == '8' ||
-      value == '9';
-}
\ No newline at end of file
+namespace {
+const unsigned char I = CHAR_INVALID;
+const unsigned char S = CHAR_SPACE;
+const unsigned char C = CHAR_COMMENT;
+const unsigned char O = CHAR_OPERATOR;
+const unsigned char D = CHAR_DIGIT;
+const unsigned char L = CHAR_LETTER;
+}
+
+// One entry per byte value, so classifying a character is a single load.
+const unsigned char CHAR_CLASSES[256] = {
+    I, I, I, I, I, I, I, I, I, S, S, S, S, S, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    S, O, I, I, I, I, O, I, O, O, O, O, O, O, O, O,
+    D, D, D, D, D, D, D, D, D, D, O, O, O, O, O, I,
+    I, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    L, L, L, L, L, L, L, L, L, L, L, I, I, I, I, I,
+    I, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L,
+    L, L, L, L, L, L, L, L, L, L, L, C, O, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+    I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+};
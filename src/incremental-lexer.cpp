@@ -0,0 +1,74 @@
+#include <utility>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "interpreter.h"
+
+IncrementalLexer::IncrementalLexer(std::string text, std::shared_ptr<Interner> symbols) : text(std::move(text)), symbols(std::move(symbols)) {
+  if (this->symbols == nullptr) {
+    this->symbols = std::make_shared<Interner>();
+  }
+  tokens = tokenize(SourceBuffer::fromView(this->text.data(), this->text.size()), this->symbols);
+}
+
+static size_t tokenEnd(const Token& token) {
+  return static_cast<size_t>(token.offset) + token.length;
+}
+
+IncrementalLexer::Change IncrementalLexer::edit(size_t offset, size_t removed, const std::string& inserted) {
+  if (offset > text.size() || removed > text.size() - offset) {
+    throw std::invalid_argument("Edit is outside of the document.");
+  }
+  std::string replaced = text.substr(offset, removed);
+  text.replace(offset, removed, inserted);
+  const long delta = static_cast<long>(inserted.size()) - static_cast<long>(removed);
+
+  // Tokens that end before the edit can not change; a token that ends right at
+  // it could be extended by the inserted text, so lexing restarts just after
+  // the last token that ends strictly before the edit.
+  auto firstChanged = std::lower_bound(tokens.begin(), tokens.end() - 1, offset, [](const Token& token, size_t at) {
+    return tokenEnd(token) < at;
+  });
+  size_t first = firstChanged - tokens.begin();
+  size_t restart = first > 0 ? tokenEnd(tokens[first - 1]) : 0;
+
+  // Old tokens that start after the edited region are candidates to line up
+  // with; once a new token starts where a shifted old one does, the lexer is in
+  // the same state on the same text and the rest of the old stream still holds.
+  size_t oldIndex = first;
+  size_t editEnd = offset + removed;
+  while (oldIndex + 1 < tokens.size() && tokens[oldIndex].offset < editEnd) {
+    oldIndex++;
+  }
+
+  std::vector<Token> relexed;
+  try {
+    Lexer lexer(SourceBuffer::fromView(text.data(), text.size()), symbols);
+    lexer.restart(restart, text.size());
+    while (true) {
+      Token token = lexer.getNextToken();
+      while (oldIndex + 1 < tokens.size() && static_cast<long>(tokens[oldIndex].offset) + delta < static_cast<long>(token.offset)) {
+        oldIndex++;
+      }
+      if (token.offset >= offset + inserted.size() && static_cast<long>(tokens[oldIndex].offset) + delta == static_cast<long>(token.offset)) {
+        break;
+      }
+      relexed.push_back(token);
+      if (token.type == Token::Type::END_OF_FILE) {
+        oldIndex = tokens.size();
+        break;
+      }
+    }
+  } catch (...) {
+    text.replace(offset, inserted.size(), replaced);
+    throw;
+  }
+
+  Change change {first, oldIndex - first, relexed.size()};
+  tokens.erase(tokens.begin() + first, tokens.begin() + oldIndex);
+  tokens.insert(tokens.begin() + first, relexed.begin(), relexed.end());
+  for (size_t i = first + relexed.size(); i < tokens.size(); ++i) {
+    tokens[i].offset = static_cast<uint32_t>(tokens[i].offset + delta);
+  }
+  return change;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "interpreter.h"
+
+IncrementalParser::IncrementalParser(std::string text, std::shared_ptr<Interner> symbols) : lexer(std::move(text), std::move(symbols)) {
+  parse(false);
+}
+
+// Leaves out offsets, so a function that only moved hashes the same.
+uint64_t IncrementalParser::hash(const Token* tokens, size_t count) {
+  const uint64_t MULTIPLIER = 0x100000001b3ULL;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const Token* token = tokens; token != tokens + count; ++token) {
+    h = (h ^ token->type) * MULTIPLIER;
+    h = (h ^ token->length) * MULTIPLIER;
+    h = (h ^ static_cast<uint64_t>(token->value)) * MULTIPLIER;
+  }
+  return h;
+}
+
+void IncrementalParser::edit(size_t offset, size_t removed, const std::string& inserted) {
+  IncrementalLexer::Change change = lexer.edit(offset, removed, inserted);
+
+  // Functions before the replaced tokens stay where they are, functions after
+  // them move by the change in token count, and the rest are parsed again.
+  std::vector<Function> kept;
+  for (const Function& function : functions) {
+    if (function.first + function.count <= change.first) {
+      kept.push_back(function);
+    } else if (function.first >= change.first + change.removed) {
+      kept.push_back(function);
+      kept.back().first = function.first + change.inserted - change.removed;
+    }
+  }
+  functions = std::move(kept);
+  parse(nodes->bytesUsed() <= 4 * freshBytes);
+}
+
+void IncrementalParser::parse(bool reusing) {
+  if (!reusing) {
+    functions.clear();
+  }
+  const std::vector<Token>& tokens = lexer.getTokens();
+  Parser parser(Lexer::Replay{tokens.data(), tokens.data() + tokens.size(), nullptr}, lexer.interner());
+  diagnostics = std::make_shared<Diagnostics>();
+  diagnostics->addLines(lexer.getText().data(), lexer.getText().size());
+  parser.setDiagnostics(diagnostics);
+  parser.reuse = this;
+  found.clear();
+  reusedCount = 0;
+  tree = parser.program();
+
+  // The reused subtrees live in the previous tree's arena.
+  if (reusedCount > 0) {
+    parser.arena()->adopt(nodes);
+  }
+  nodes = parser.arena();
+  if (!reusing) {
+    freshBytes = nodes->bytesUsed();
+  }
+  functions = std::move(found);
+}
+
+FunctionDecl* IncrementalParser::reusable(size_t first, size_t& end) {
+  errorsBefore = diagnostics->size();
+  auto function = std::lower_bound(functions.begin(), functions.end(), first, [](const Function& function, size_t at) {
+    return function.first < at;
+  });
+  const std::vector<Token>& tokens = lexer.getTokens();
+  if (function == functions.end() || function->first != first || first + function->count >= tokens.size() ||
+      hash(tokens.data() + first, function->count) != function->hash) {
+    return nullptr;
+  }
+  found.push_back(*function);
+  reusedCount++;
+  end = first + function->count;
+  return function->decl;
+}
+
+void IncrementalParser::parsed(size_t first, size_t end, FunctionDecl* decl) {
+  // A function with errors is parsed again next time, so its errors are reported again.
+  if (diagnostics->size() == errorsBefore) {
+    found.push_back(Function{first, end - first, hash(lexer.getTokens().data() + first, end - first), decl});
+  }
+}
@@ -0,0 +1,65 @@
+#include <utility>
+#include "interpreter.h"
+
+// FNV-1a over the case-folded identifier. Identifiers only contain letters and
+// digits, and clearing the lowercase bit of a digit can not turn it into a letter.
+static uint32_t hashIdentifier(const char* text, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<unsigned char>(text[i] & ~0x20);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static bool sameIdentifier(const std::string& name, const char* text, size_t length) {
+  if (name.size() != length) {
+    return false;
+  }
+  for (size_t i = 0; i < length; ++i) {
+    if ((name[i] & ~0x20) != (text[i] & ~0x20)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Interner::Interner() : slots(64, 0) {}
+
+Symbol Interner::intern(const char* text, size_t length) {
+  uint32_t hash = hashIdentifier(text, length);
+  size_t mask = slots.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Symbol slot = slots[i];
+    if (slot == 0) {
+      auto symbol = static_cast<Symbol>(names.size());
+      names.emplace_back(text, length);
+      hashes.push_back(hash);
+      slots[i] = symbol + 1;
+      if (names.size() * 2 > slots.size()) {
+        grow();
+      }
+      return symbol;
+    }
+    if (hashes[slot - 1] == hash && sameIdentifier(names[slot - 1], text, length)) {
+      return slot - 1;
+    }
+  }
+}
+
+Symbol Interner::intern(const std::string& text) {
+  return intern(text.data(), text.size());
+}
+
+void Interner::grow() {
+  std::vector<Symbol> larger(slots.size() * 2, 0);
+  size_t mask = larger.size() - 1;
+  for (Symbol symbol = 0; symbol < names.size(); ++symbol) {
+    size_t i = hashes[symbol] & mask;
+    while (larger[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    larger[i] = symbol + 1;
+  }
+  slots = std::move(larger);
+}
@@ -0,0 +1,95 @@
+#include "interpreter.h"
+
+int64_t unaryOpValue(Token::Type op, int64_t value) {
+  if (op == Token::Type::PLUS) {
+    return value;
+  } else if (op == Token::Type::MINUS) {
+    return -value;
+  } else if (op == Token::Type::NOT) {
+    return value != 1 ? 1 : 0;
+  }
+  throw std::invalid_argument("Invalid unary op.");
+}
+
+int64_t binaryOpValue(Token::Type op, int64_t leftValue, int64_t rightValue) {
+  if (op == Token::Type::PLUS) {
+    return leftValue + rightValue;
+  } else if (op == Token::Type::MINUS) {
+    return leftValue - rightValue;
+  } else if (op == Token::Type::MULTPLY) {
+    return leftValue * rightValue;
+  } else if (op == Token::Type::DIVIDE) {
+    return leftValue / rightValue;
+  } else if (op == Token::Type::OR) {
+    return (leftValue == 1) || (rightValue == 1) ? 1 : 0;
+  } else if (op == Token::Type::AND) {
+    return (leftValue == 1) && (rightValue == 1) ? 1 : 0;
+  } else if (op == Token::Type::EQUAL) {
+    return leftValue == rightValue ? 1 : 0;
+  } else if (op == Token::Type::NOT_EQUAL) {
+    return leftValue != rightValue ? 1 : 0;
+  } else if (op == Token::Type::GREATER) {
+    return leftValue > rightValue ? 1 : 0;
+  } else if (op == Token::Type::GREATER_EQUAL) {
+    return leftValue >= rightValue ? 1 : 0;
+  } else if (op == Token::Type::LESS) {
+    return leftValue < rightValue ? 1 : 0;
+  } else if (op == Token::Type::LESS_EQUAL) {
+    return leftValue <= rightValue ? 1 : 0;
+  }
+  throw std::invalid_argument("Invalid binary op.");
+}
+
+void PrintVisitor::evaluate(AST& expression) {
+  size_t base = operators.size();
+  AST* node = &expression;
+  while (true) {
+    // Down to the leftmost operand, leaving the operators on the way for later.
+    while (true) {
+      if (auto unary = dynamic_cast<UnaryOp*>(node)) {
+        operators.push_back({PendingOperator<AST*>::UNARY, unary->op.type, nullptr, 0});
+        node = unary->node;
+      } else if (auto binary = dynamic_cast<BinaryOp*>(node)) {
+        operators.push_back({PendingOperator<AST*>::LEFT, binary->op.type, binary->right, 0});
+        node = binary->left;
+      } else {
+        break;
+      }
+    }
+    node->accept(*this);
+    // Applies the operators that have all their operands, up to the next right operand.
+    node = nullptr;
+    while (node == nullptr) {
+      if (operators.size() == base) {
+        return;
+      }
+      auto& pending = operators.back();
+      if (pending.stage == PendingOperator<AST*>::LEFT) {
+        pending.stage = PendingOperator<AST*>::RIGHT;
+        pending.left = value;
+        node = pending.right;
+      } else {
+        value = pending.stage == PendingOperator<AST*>::UNARY ? unaryOpValue(pending.op, value) : binaryOpValue(pending.op, pending.left, value);
+        operators.pop_back();
+      }
+    }
+  }
+}
+
+void PrintVisitor::runStatements(Compound& compound) {
+  size_t base = statements.size();
+  statements.push_back({&compound, 0});
+  while (statements.size() > base) {
+    auto& pending = statements.back();
+    if (pending.next == pending.compound->children.size()) {
+      statements.pop_back();
+      continue;
+    }
+    AST* statement = pending.compound->children[pending.next++];
+    if (auto nested = dynamic_cast<Compound*>(statement)) {
+      statements.push_back({nested, 0});
+    } else {
+      statement->accept(*this);
+    }
+  }
+}
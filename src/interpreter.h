@@ -12,17 +12,119 @@
 #include <memory>
 #include <iostream>
 #include<map>
+#include <cstdint>
+#include <string_view>
+#include <functional>
 #include "stack.h"
+#include "arena.h"
 
 // Helper
 
-bool isDigit(const char & value);
+enum CharClass : unsigned char {
+  CHAR_INVALID,
+  CHAR_SPACE,
+  CHAR_COMMENT,
+  CHAR_OPERATOR,
+  CHAR_DIGIT,
+  CHAR_LETTER
+};
+
+extern const unsigned char CHAR_CLASSES[256];
+
+inline CharClass charClass(const char & value) {
+  return static_cast<CharClass>(CHAR_CLASSES[static_cast<unsigned char>(value)]);
+}
+
+inline bool isDigit(const char & value) {
+  return charClass(value) == CHAR_DIGIT;
+}
+
+inline bool isAlnum(const char & value) {
+  return charClass(value) >= CHAR_DIGIT;
+}
+
+// Source
+
+// Owns the program text as one contiguous, read-only buffer. Files are
+// memory-mapped where the platform allows it, so loading never copies the
+// source; everything else is read once into a single string.
+class SourceBuffer {
+private:
+  const char* data = nullptr;
+  size_t length = 0;
+  std::string owned;
+  void* mapping = nullptr;
+  size_t mappedLength = 0;
+
+  SourceBuffer() = default;
+public:
+  SourceBuffer(const SourceBuffer&) = delete;
+  SourceBuffer& operator=(const SourceBuffer&) = delete;
+  ~SourceBuffer();
+
+  static std::shared_ptr<SourceBuffer> fromFile(const std::string& filename);
+  static std::shared_ptr<SourceBuffer> fromString(std::string text);
+  static std::shared_ptr<SourceBuffer> fromLines(const std::vector<std::string>& lines);
+  // Wraps memory owned by the caller, which has to outlive the buffer.
+  static std::shared_ptr<SourceBuffer> fromView(const char* data, size_t size);
+
+  const char* begin() const { return data; }
+  const char* end() const { return data + length; }
+  size_t size() const { return length; }
+};
+
+// Reads a program from a file descriptor a chunk at a time, for sources that
+// arrive on stdin or through a pipe and may still be being written.
+class SourceStream {
+private:
+  int fd;
+  bool ownsFd;
+public:
+  static const size_t CHUNK_SIZE = 64 * 1024;
+
+  explicit SourceStream(int fd, bool ownsFd = false): fd(fd), ownsFd(ownsFd) {}
+  SourceStream(const SourceStream&) = delete;
+  SourceStream& operator=(const SourceStream&) = delete;
+  ~SourceStream();
+
+  static std::shared_ptr<SourceStream> fromFile(const std::string& filename);
+
+  // Blocks until some input is available; returns 0 once the input has ended.
+  size_t read(char* into, size_t capacity);
+};
+
+// Symbols
+
+typedef uint32_t Symbol;
+
+// Maps every distinct identifier of one compilation to a dense Symbol id, so the
+// parser and interpreter compare and look up integers instead of strings.
+// Identifiers are case-insensitive; name() returns the first spelling seen.
+class Interner {
+private:
+  std::vector<std::string> names;
+  std::vector<uint32_t> hashes;
+  // Open addressed table of symbol + 1, zero marks an empty slot.
+  std::vector<Symbol> slots;
+
+  void grow();
+public:
+  Interner();
+  Symbol intern(const char* text, size_t length);
+  Symbol intern(const std::string& text);
+  const std::string& name(Symbol symbol) const { return names[symbol]; }
+  size_t size() const { return names.size(); }
+};
 
 // Core
 
+class SourceBuffer;
+
+// Tokens are 16 trivially copyable bytes: they refer back to their text in the
+// source by offset and length instead of owning a copy of it.
 class Token {
 public:
-  enum Type {
+  enum Type : uint8_t {
     PROGRAM,
     BEGIN,
     END,
@@ -64,44 +166,160 @@ public:
   };
 
 
-  std::string name;
+  // Set on INTEGER_CONST tokens whose value does not fit in 32 bits.
+  static const uint8_t WIDE = 1;
+  static const size_t MAX_LENGTH = UINT16_MAX;
+
   Type type;
-  int value = 0;
+  uint8_t flags = 0;
+  // How long the token's text is, and where it starts in the whole program.
+  // In-memory sources are limited to 4 GB; offsets into longer streams wrap.
+  uint16_t length = 0;
+  uint32_t offset = 0;
+  union {
+    // INTEGER_CONST, TRUE and FALSE.
+    int64_t value = 0;
+    // ID.
+    Symbol symbol;
+  };
+
   Token(Type type);
-  Token(Type type, int value);
-  Token(std::string name, Type type, int value);
-};
-
-//std::map<std::string, Token> createReserved() {
-//  std::map<std::string, Token> reserved;
-//  reserved["TRUE"] = Token(Token::Type::TRUE, 1);
-//  reserved["FALSE"] = Token(Token::Type::FALSE, 0);
-//  return reserved;
-//}
-
-const std::map<std::string, Token> RESERVED_KEYWORDS = {
-    {"TRUE", Token(Token::Type::TRUE, 1)},
-    {"FALSE", Token(Token::Type::FALSE, 0)},
-    {"PROGRAM", Token(Token::Type::PROGRAM)},
-    {"BEGIN", Token(Token::Type::BEGIN)},
-    {"END", Token(Token::Type::END)},
-    {"VAR", Token(Token::Type::VAR)},
-    {"BOOLEAN", Token(Token::Type::BOOLEAN)},
-    {"INTEGER", Token(Token::Type::INTEGER)},
-    {"FUNCTION", Token(Token::Type::FUNCTION)},
-    {"PROCEDURE", Token(Token::Type::PROCEDURE)}
+  Token(Type type, int64_t value);
+  Token(Symbol symbol, Type type);
+
+  // Only valid while the buffer the token was lexed from is alive.
+  std::string_view text(const SourceBuffer& source) const;
 };
 
-class Lexer {
+// Reserved keywords are matched case-insensitively; returns Token::Type::ID for anything else.
+Token::Type keywordType(const char* text, size_t length);
+
+// How a token type is spelled in messages, e.g. ":=" or "identifier".
+const char* tokenName(Token::Type type);
+
+// Diagnostics
+
+enum class DiagnosticCode : uint8_t {
+  INVALID_CHARACTER,
+  INVALID_OPERATOR,
+  UNTERMINATED_COMMENT,
+  INTEGER_OUT_OF_RANGE,
+  TOKEN_TOO_LONG,
+  UNEXPECTED_TOKEN,
+  EXPECTED_EXPRESSION,
+  EXPECTED_TYPE,
+  NESTING_TOO_DEEP
+};
+
+const char* diagnosticMessage(DiagnosticCode code);
+
+struct Diagnostic {
+  DiagnosticCode code;
+  // Only set for UNEXPECTED_TOKEN.
+  Token::Type expected;
+  Token::Type found;
+  uint32_t offset;
+  uint32_t length;
+};
+
+// Collects lexer and parser errors so a whole program can be checked in one
+// pass without unwinding. Positions are kept as offsets and only turned into
+// lines and columns when asked for, from the line starts seen so far.
+class Diagnostics {
 private:
-  std::vector<std::string> lines;
-  int pos = 0;
-  int line = 0;
+  std::vector<Diagnostic> entries;
+  // Offset of the first character of every line but the first.
+  std::vector<uint32_t> lineStarts;
+  size_t scanned = 0;
+public:
+  struct Position {
+    // Both start at 1; zero when the source text around the offset was never seen.
+    uint32_t line;
+    uint32_t column;
+  };
+
+  void report(const Diagnostic& diagnostic) { entries.push_back(diagnostic); }
+  // Adds the other's diagnostics, keeping all of them in source order.
+  void merge(const Diagnostics& other);
+  // Records the line starts in the next length characters of the program.
+  void addLines(const char* text, size_t length);
+  bool hasLines() const { return scanned > 0; }
+  Position position(size_t offset) const;
+
+  bool empty() const { return entries.empty(); }
+  size_t size() const { return entries.size(); }
+  // Keeps only the first count diagnostics, e.g. before parsing a part of the program again.
+  void truncate(size_t count) { entries.resize(count); }
+  const Diagnostic& operator[](size_t i) const { return entries[i]; }
+
+  // One line per diagnostic, as name:line:column: message.
+  void print(std::ostream& out, const std::string& name) const;
+};
+
+struct ScanKernels;
+class TokenCache;
 
-  char peekChar();
+class Lexer {
+private:
+  static const int LOOKAHEAD = 4;
+
+  std::shared_ptr<SourceBuffer> source;
+  std::shared_ptr<Interner> symbols;
+  const char* cur;
+  const char* end;
+  const ScanKernels* kernels;
+
+  // Streaming input: the characters in [base, end) start at windowOffset in the
+  // whole program, and fill() slides the window forward one chunk at a time.
+  std::shared_ptr<SourceStream> stream;
+  std::vector<char> window;
+  const char* base;
+  size_t windowOffset = 0;
+
+  bool fill(const char*& keep);
+  size_t offset(const char* position) const { return windowOffset + (position - base); }
+
+  // Tokens lexed ahead of time (see tokenize()), served instead of scanning.
+  // The last one is always END_OF_FILE.
+  std::shared_ptr<const void> replayOwner;
+  const Token* replayBegin = nullptr;
+  const Token* replayCur = nullptr;
+  const Token* replayEnd = nullptr;
+
+  // Ring buffer of tokens that were lexed by peek() but not consumed yet.
+  std::vector<Token> lookahead;
+  int lookaheadStart = 0;
+  int lookaheadCount = 0;
+
+  // Number of times each source character was scanned, only kept while counting is enabled.
+  std::vector<unsigned> scans;
+  bool countingScans = false;
+
+  // Errors are reported here when set, and thrown otherwise.
+  std::shared_ptr<Diagnostics> diagnostics;
+
+  Token lexToken();
+  Token operatorToken();
+  Token scanToken();
 public:
-  explicit Lexer(std::vector<std::string> lines);
-  bool advance();
+  explicit Lexer(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols = nullptr);
+  explicit Lexer(std::shared_ptr<SourceStream> stream, std::shared_ptr<Interner> symbols = nullptr, size_t chunkSize = SourceStream::CHUNK_SIZE);
+  Lexer(std::shared_ptr<const std::vector<Token>> tokens, std::shared_ptr<Interner> symbols);
+  // Replays the tokens straight out of the cache's mapping.
+  explicit Lexer(std::shared_ptr<const TokenCache> cache);
+  explicit Lexer(const std::vector<std::string>& lines);
+  // Tokens being replayed, and whatever keeps them alive.
+  struct Replay {
+    const Token* begin;
+    const Token* end;
+    std::shared_ptr<const void> owner;
+  };
+  // Replays the same tokens as another lexer, e.g. to parse part of them on
+  // another thread. Replaying never interns, so the interner can be shared.
+  Lexer(Replay replay, std::shared_ptr<Interner> symbols);
+  Lexer(const Lexer&) = delete;
+  Lexer& operator=(const Lexer&) = delete;
+  void advance();
   void skipWhitespace();
   void skipComment();
   bool isEmpty();
@@ -110,54 +328,236 @@ public:
   Token getNextToken();
   Token peek(const int & count = 1);
   Token number();
+
+  // Continues lexing an in-memory source at offset from, stopping at offset to.
+  void restart(size_t from, size_t to);
+  // mark() is where the next token starts: an offset into an in-memory source,
+  // or an index into replayed tokens. resume() goes back to a mark and drops
+  // the lookahead. Streams can not go back.
+  bool canResume() const { return source != nullptr || replayCur != nullptr; }
+  bool replaying() const { return replayCur != nullptr; }
+  Replay replay() const { return {replayBegin, replayEnd, replayOwner}; }
+  size_t mark();
+  void resume(size_t mark);
+
+  void countScans(bool enabled);
+  const std::vector<unsigned>& scanCounts() const { return scans; }
+  const std::shared_ptr<Interner>& interner() const { return symbols; }
+
+  // Use one Diagnostics per program, set before the first token is lexed:
+  // streams record line starts as chunks arrive.
+  void setDiagnostics(std::shared_ptr<Diagnostics> diagnostics);
+  const std::shared_ptr<Diagnostics>& diagnosticsSink() const { return diagnostics; }
+  // Throws std::invalid_argument when no diagnostics are set; otherwise records
+  // the error and returns so the caller can recover.
+  void report(DiagnosticCode code, size_t offset, size_t length, Token::Type expected = Token::Type::END_OF_FILE, Token::Type found = Token::Type::END_OF_FILE);
+};
+
+// Lexes a whole in-memory source up front. The tokens end with END_OF_FILE.
+std::vector<Token> tokenize(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols);
+
+// Produces exactly the tokens tokenize() does, including symbol numbering and
+// spellings, by lexing chunks of the source on a pool of threads. Zero threads uses every core.
+std::vector<Token> tokenizeParallel(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols, unsigned threads = 0);
+
+// Keeps the tokens of a document that is being edited, and after each edit
+// re-lexes only from the last token before the edit until the new tokens line
+// up with the old ones again.
+class IncrementalLexer {
+private:
+  std::string text;
+  std::shared_ptr<Interner> symbols;
+  // Always ends with END_OF_FILE.
+  std::vector<Token> tokens;
+public:
+  // Which tokens an edit replaced: tokens [first, first + removed) of the old
+  // stream became tokens [first, first + inserted) of the new one.
+  struct Change {
+    size_t first;
+    size_t removed;
+    size_t inserted;
+  };
+
+  explicit IncrementalLexer(std::string text, std::shared_ptr<Interner> symbols = nullptr);
+
+  // Replaces removed characters at offset with inserted. If the new text does
+  // not lex, throws and leaves the document unchanged.
+  Change edit(size_t offset, size_t removed, const std::string& inserted);
+
+  const std::string& getText() const { return text; }
+  const std::vector<Token>& getTokens() const { return tokens; }
+  const std::shared_ptr<Interner>& interner() const { return symbols; }
+};
+
+// A token stream saved to disk together with its identifier table, keyed by a
+// hash of the source it was lexed from. Loading maps the file and replays the
+// tokens in place, so only the identifier names are copied.
+class TokenCache {
+private:
+  std::shared_ptr<SourceBuffer> file;
+  const Token* first = nullptr;
+  const Token* last = nullptr;
+  std::shared_ptr<Interner> symbols;
+
+  TokenCache() = default;
+  static std::shared_ptr<TokenCache> load(const std::string& path, size_t sourceSize, uint64_t sourceHash);
+public:
+  // Bumped whenever the file layout or Token changes.
+  static const uint32_t VERSION = 1;
+
+  static uint64_t hash(const SourceBuffer& source);
+  // Returns nullptr when the file is missing, damaged, from another version,
+  // or was written for a different source.
+  static std::shared_ptr<TokenCache> load(const std::string& path, const SourceBuffer& source);
+  // Returns false when the file could not be written.
+  static bool save(const std::string& path, const SourceBuffer& source, const std::vector<Token>& tokens, const Interner& symbols);
+  // Loads the cache for source from directory, lexing and saving it first when
+  // there is none yet. Returns nullptr when the source does not lex or the
+  // cache can not be written; callers then lex normally.
+  static std::shared_ptr<TokenCache> open(const std::string& directory, const SourceBuffer& source);
+
+  const Token* begin() const { return first; }
+  const Token* end() const { return last; }
+  size_t size() const { return last - first; }
+  const std::shared_ptr<Interner>& interner() const { return symbols; }
 };
 
 class AST;
+class FunctionDecl;
+class IncrementalParser;
+typedef ArenaArray<AST*> NodeList;
 
+// Nodes are allocated in the parser's arena and live as long as it does; keep
+// arena() to use them after the parser is gone.
 class Parser {
 private:
-  std::vector<std::string> lines;
   Lexer lexer;
+  // Set after an error until the parser gets back to a statement boundary, so
+  // one mistake is reported once instead of cascading.
+  bool panicking = false;
+  bool lazyFunctions = false;
+  bool parallelFunctions = false;
+  unsigned parallelThreads = 0;
+  // Top-level FUNCTIONs whose bodies were skipped to be parsed in parallel.
+  std::vector<FunctionDecl*> unparsed;
+  bool iterative = false;
+  // How many FUNCTIONs, and with iterative parsing how many BEGINs, parentheses,
+  // unary operators and calls, are open around the current token.
+  size_t depth = 0;
+  size_t maxDepth = DEFAULT_MAX_DEPTH;
+  // Offers the program's FUNCTIONs of a previous parse for reuse.
+  IncrementalParser* reuse = nullptr;
+  friend class IncrementalParser;
+
+  // Identifies a leaf or operator node by its contents, with children compared
+  // by address: they are shared already, so equal addresses mean equal trees.
+  struct ConsKey {
+    enum Kind : uint8_t {NUM, BOOLEAN, VAR, UNARY_OP, BINARY_OP, TYPE} kind;
+    Token::Type op;
+    int64_t value;
+    const AST* left;
+    const AST* right;
+  };
+  class ConsTable;
+  bool hashConsing = false;
+  // The shareable nodes made so far, while hash consing; the parsers of
+  // parallel bodies use their parent's. Dropped when program() returns, unless
+  // lazy bodies may still be parsed.
+  std::shared_ptr<ConsTable> consed;
+  // make() for nodes that can be shared: with hash consing, returns the node
+  // made earlier for an equal key instead of a new one.
+  template <typename T, typename... Args>
+  AST* makeShared(const ConsKey& key, Args&&... args);
+  std::shared_ptr<Arena> nodes;
+  // Items of the lists being built, innermost list last.
+  std::vector<AST*> pending;
+
+  NodeList takeList(size_t from);
+
+  void fail(DiagnosticCode code, const Token& at, Token::Type expected = Token::Type::END_OF_FILE);
+  void synchronize();
+  void skipBlock();
+  Parser(Lexer::Replay replay, std::shared_ptr<Interner> symbols);
+  bool parseUnparsedBodies();
+  void rewind(size_t mark, size_t reported);
+  bool tooDeep(const Token& at);
+  AST* iterativeExpression();
+  AST* iterativeCompound();
+  NodeList statementList(const std::function<void(AST*)>& parsed);
 public:
-  Parser(std::vector<std::string> lines);
+  static const size_t DEFAULT_MAX_DEPTH = 1 << 20;
+
+  explicit Parser(std::shared_ptr<SourceBuffer> source);
+  explicit Parser(std::shared_ptr<SourceStream> stream);
+  Parser(std::shared_ptr<const std::vector<Token>> tokens, std::shared_ptr<Interner> symbols);
+  explicit Parser(std::shared_ptr<const TokenCache> cache);
+  explicit Parser(const std::vector<std::string>& lines);
   Token eat(Token::Type type);
+  const std::shared_ptr<Interner>& interner() const { return lexer.interner(); }
+  // Reports syntax errors to diagnostics and recovers instead of throwing.
+  void setDiagnostics(std::shared_ptr<Diagnostics> diagnostics) { lexer.setDiagnostics(std::move(diagnostics)); }
+  const std::shared_ptr<Arena>& arena() const { return nodes; }
+  // Skips FUNCTION bodies and parses each the first time FunctionDecl::body()
+  // is called, which needs the parser to still be alive. Errors in a body are
+  // only found once it is parsed. Has no effect on streamed sources.
+  void setLazyFunctions(bool lazy) { lazyFunctions = lazy; }
+  // Skips the bodies of the program's FUNCTIONs and, once the rest of the
+  // program is parsed, parses them concurrently on threads (zero uses every
+  // core). Only parsers over replayed tokens can do this, since the threads
+  // share the tokens; lazy parsing takes precedence.
+  void setParallelFunctions(bool parallel, unsigned threads = 0) { parallelFunctions = parallel; parallelThreads = threads; }
+  // Parses expressions and nested BEGIN ... END with explicit stacks instead of
+  // recursion, so deeply nested programs can not overflow the call stack.
+  // Nesting deeper than maxDepth is reported and skipped. The trees are the
+  // same as the recursive parser's.
+  void setIterative(bool enabled, size_t limit = DEFAULT_MAX_DEPTH) { iterative = enabled; maxDepth = limit; }
+  // Shares one node between all equal literals, variable references, types
+  // and operator trees over them, so equal expressions are the same node.
+  // Calls, assignments and blocks are never shared. A shared operator keeps
+  // the offset of the first occurrence. Bodies parsed in parallel share one
+  // locked table, so there it is the occurrence that was parsed first.
+  void setHashConsing(bool enabled) { hashConsing = enabled; }
+  AST* deferredBlock(size_t mark, size_t outerDepth);
 
   // Literals
-  std::shared_ptr<AST> number();
-  std::shared_ptr<AST> boolean();
-  std::shared_ptr<AST> variable();
+  AST* number();
+  AST* boolean();
+  AST* variable();
 
   // Expressions
-  std::shared_ptr<AST> factor();
-  std::shared_ptr<AST> multDivFactor();
-  std::shared_ptr<AST> addSubFactor();
-  std::shared_ptr<AST> relationalFactor();
-  std::shared_ptr<AST> andFactor();
-  std::shared_ptr<AST> orFactor();
-  std::shared_ptr<AST> comparisonFactor();
-  std::shared_ptr<AST> expression();
+  AST* factor();
+  AST* binaryExpression(int minPower);
+  AST* expression();
 
   // Program Structure
-  std::shared_ptr<AST> program();
-  std::shared_ptr<AST> compoundStatement();
-  std::shared_ptr<AST> empty();
-  std::shared_ptr<AST> block();
+  AST* program();
+  // program() for running a program while it is parsed. declared gets the
+  // Program once its declarations are parsed, with no main block yet, and
+  // parsed gets each statement of the main block as soon as it is complete.
+  // Neither is called after the first syntax error. Every FUNCTION body is
+  // parsed before declared is called, even with lazy parsing.
+  AST* streamProgram(const std::function<void(AST*)>& declared, const std::function<void(AST*)>& parsed);
+  AST* compoundStatement();
+  AST* empty();
+  AST* block();
 
   // Statements
-  std::vector<std::shared_ptr<AST>> statementList();
-  std::shared_ptr<AST> statement();
-  std::shared_ptr<AST> assignmentStatement();
+  NodeList statementList();
+  AST* statement();
+  AST* assignmentStatement();
 
-//  std::shared_ptr<AST> ifStatement();
-//  std::shared_ptr<AST> whileStatement();
-  std::shared_ptr<AST> callStatement();
+//  AST* ifStatement();
+//  AST* whileStatement();
+  AST* callStatement();
 
   // Function/Procedure Setup
-  std::vector<std::shared_ptr<AST>> declarations();
-  std::vector<std::shared_ptr<AST>> formalParameterList();
-  std::vector<std::shared_ptr<AST>> formalParameter();
-  std::vector<std::shared_ptr<AST>> variableDeclaration();
-  std::shared_ptr<AST> typeSpec();
+  NodeList declarations();
+  NodeList formalParameterList();
+  // Appends one Param per name to the list being built.
+  void formalParameter();
+  // Appends one VarDecl per name to the list being built.
+  void variableDeclaration();
+  AST* typeSpec();
 
 };
 
@@ -214,8 +614,8 @@ public:
 
 class Num : public AST {
 public:
-  int value;
-  Num(int value);
+  int64_t value;
+  Num(int64_t value);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -234,8 +634,8 @@ public:
 
 class Var : public AST {
 public:
-  std::string name;
-  explicit Var(std::string name);
+  Symbol symbol;
+  explicit Var(Symbol symbol);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -245,8 +645,8 @@ public:
 class UnaryOp : public AST {
 public:
   Token op;
-  std::shared_ptr<AST> node;
-  UnaryOp(Token op, std::shared_ptr<AST> node);
+  AST* node;
+  UnaryOp(Token op, AST* node);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -255,10 +655,10 @@ public:
 
 class BinaryOp: public AST {
 public:
-  std::shared_ptr<AST> left;
+  AST* left;
   Token op;
-  std::shared_ptr<AST> right;
-  BinaryOp(std::shared_ptr<AST> left, Token op, std::shared_ptr<AST> right);
+  AST* right;
+  BinaryOp(AST* left, Token op, AST* right);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -267,9 +667,9 @@ public:
 
 class Program : public AST {
 public:
-  std::shared_ptr<AST> name;
-  std::shared_ptr<AST> block;
-  Program(std::shared_ptr<AST> programName, std::shared_ptr<AST> block);
+  AST* name;
+  AST* block;
+  Program(AST* programName, AST* block);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -278,7 +678,8 @@ public:
 
 class Compound : public AST {
 public:
-  std::vector<std::shared_ptr<AST>> children;
+  NodeList children;
+  explicit Compound(NodeList children): children(children) {}
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -286,9 +687,9 @@ public:
 
 class Block : public AST {
 public:
-  std::vector<std::shared_ptr<AST>> declarations;
-  std::shared_ptr<AST> compoundStatement;
-  Block(std::vector<std::shared_ptr<AST>> declarations, std::shared_ptr<AST> compoundStatement);
+  NodeList declarations;
+  AST* compoundStatement;
+  Block(NodeList declarations, AST* compoundStatement);
 
   void accept(Visitor& v) override {
     v.visit(*this);
@@ -297,9 +698,9 @@ public:
 
 class Assign : public AST {
 public:
-  std::shared_ptr<AST> left;
-  std::shared_ptr<AST> right;
-  Assign(std::shared_ptr<AST> left, std::shared_ptr<AST> right);
+  AST* left;
+  AST* right;
+  Assign(AST* left, AST* right);
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -314,9 +715,9 @@ public:
 
 class VarDecl : public AST {
 public:
-  std::shared_ptr<AST> var;
-  std::shared_ptr<AST> type;
-  VarDecl(std::shared_ptr<AST> var, std::shared_ptr<AST> type): var(std::move(var)), type(std::move(type)) {}
+  AST* var;
+  AST* type;
+  VarDecl(AST* var, AST* type): var(var), type(type) {}
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -324,8 +725,9 @@ public:
 
 class Type : public AST {
 public:
-  std::string name;
-  explicit Type(std::string name): name(std::move(name)) {}
+  // A string literal, such as "INTEGER".
+  const char* name;
+  explicit Type(const char* name): name(name) {}
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -333,20 +735,35 @@ public:
 
 class Param : public AST {
 public:
-  std::shared_ptr<AST> var;
-  std::shared_ptr<AST> type;
-  Param(std::shared_ptr<AST> var, std::shared_ptr<AST> type): var(std::move(var)), type(std::move(type)) {}
+  AST* var;
+  AST* type;
+  Param(AST* var, AST* type): var(var), type(type) {}
   void accept(Visitor& v) override {
     v.visit(*this);
   }
 };
 
+// A function body that was skipped while parsing, to be parsed on first use.
+struct DeferredBlock {
+  Parser* parser;
+  // Lexer::mark() of the first token of the block, and of the token after it.
+  size_t mark;
+  size_t end;
+  // Parser depth at the FUNCTION, which its body is parsed one level below.
+  size_t depth;
+  AST* block;
+};
+
 class FunctionDecl : public AST {
 public:
-  std::shared_ptr<AST> name;
-  std::vector<std::shared_ptr<AST>> params;
-  std::shared_ptr<AST> block;
-  FunctionDecl(std::shared_ptr<AST> name, std::vector<std::shared_ptr<AST>> params, std::shared_ptr<AST> block): name(std::move(name)), params(std::move(params)), block(std::move(block)) {}
+  AST* name;
+  NodeList params;
+  // Null until body() parses a deferred block.
+  AST* block;
+  DeferredBlock* deferred;
+  FunctionDecl(AST* name, NodeList params, AST* block, DeferredBlock* deferred = nullptr): name(name), params(params), block(block), deferred(deferred) {}
+  // The block, parsed now if it was deferred. Copies of a declaration share the parsed block.
+  AST* body();
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -354,9 +771,9 @@ public:
 
 class Call : public AST {
 public:
-  std::shared_ptr<AST> name;
-  std::vector<std::shared_ptr<AST>> actualParams;
-  explicit Call(std::shared_ptr<AST> name, std::vector<std::shared_ptr<AST>> actualParams): name(std::move(name)), actualParams(std::move(actualParams)) {}
+  AST* name;
+  NodeList actualParams;
+  explicit Call(AST* name, NodeList actualParams): name(name), actualParams(actualParams) {}
   void accept(Visitor& v) override {
     v.visit(*this);
   }
@@ -367,12 +784,14 @@ public:
 class NumberValue;
 class BooleanValue;
 class ASTValue;
+class FlatFunctionValue;
 
 class RecordValueVisitor {
 public:
   virtual void visit(NumberValue& el) = 0;
   virtual void visit(BooleanValue& el) = 0;
   virtual void visit(ASTValue& el) = 0;
+  virtual void visit(FlatFunctionValue& el) = 0;
 };
 
 class RecordValue {
@@ -382,8 +801,8 @@ public:
 
 class NumberValue: public RecordValue {
 public:
-  int value;
-  NumberValue(int value): value(value) {}
+  int64_t value;
+  NumberValue(int64_t value): value(value) {}
   void accept(RecordValueVisitor& v) override {
     v.visit(*this);
   }
@@ -409,39 +828,68 @@ public:
 
 class ActivationRecord {
 private:
-  std::map<std::string, std::shared_ptr<RecordValue>> members;
+  // Indexed by Symbol, grown on demand up to the largest symbol set in this record.
+  std::vector<std::shared_ptr<RecordValue>> members;
+
+  std::shared_ptr<RecordValue>& slot(Symbol name);
 public:
   enum Type {
     PROGRAM,
     PROCEDURE,
     FUNCTION
   };
-  std::string name;
+  Symbol name;
   Type type;
   int level;
   std::shared_ptr<ActivationRecord> parent;
 
-  ActivationRecord(std::string name, Type type, int level, std::shared_ptr<ActivationRecord> parent): name(std::move(name)), type(type), level(level), parent(std::move(parent)) {}
+  ActivationRecord(Symbol name, Type type, int level, std::shared_ptr<ActivationRecord> parent): name(name), type(type), level(level), parent(std::move(parent)) {}
 
-  void print();
-  std::shared_ptr<RecordValue> get(std::string name);
-  void set(std::string name, bool value);
-  void set(std::string name, int value);
-  void set(std::string name, FunctionDecl value);
+  void print(const Interner& symbols);
+  std::shared_ptr<RecordValue> get(Symbol name);
+  void set(Symbol name, bool value);
+  void set(Symbol name, int64_t value);
+  void set(Symbol name, FunctionDecl value);
+  void set(Symbol name, std::shared_ptr<RecordValue> value);
 };
 
 // Interpreter
 
+// Booleans are 1 and 0. Throws on tokens that are not operators.
+int64_t unaryOpValue(Token::Type op, int64_t value);
+int64_t binaryOpValue(Token::Type op, int64_t left, int64_t right);
+
+// Expressions and BEGIN ... END blocks can nest deeper than the call stack
+// allows, so the interpreters keep explicit stacks of these for them.
+// An operator waiting for an operand: the operand of a unary one, or the left
+// or the right operand of a binary one.
+template <typename Node>
+struct PendingOperator {
+  enum Stage : uint8_t {UNARY, LEFT, RIGHT} stage;
+  Token::Type op;
+  Node right;
+  int64_t left;
+};
+// A compound statement and the index of its next statement.
+template <typename Node>
+struct PendingStatements {
+  Node compound;
+  size_t next;
+};
+
 class PrintVisitor: public Visitor, public RecordValueVisitor {
 public:
-  int value = 0;
-  std::string name;
+  int64_t value = 0;
+  Symbol name = 0;
 //  std::map<std::string, int> values;
   std::shared_ptr<ActivationRecord> callstack = nullptr;
+  std::shared_ptr<Interner> symbols;
+
+  explicit PrintVisitor(std::shared_ptr<Interner> symbols): symbols(std::move(symbols)) {}
 
   void print() {
     if (callstack != nullptr) {
-      callstack->print();
+      callstack->print(*symbols);
     }
 //    for(const auto & item : values) {
 //      std::cout << item.first << " " << item.second << std::endl;
@@ -461,13 +909,16 @@ public:
   }
   void visit(ASTValue& val) override {
     // TODO: set param name to val.value.params value
-    val.value.block->accept(*this);
+    val.value.body()->accept(*this);
 //    throw std::invalid_argument("NOT CREATED");
 //    value = val.value ? 1 : 0;
   }
+  void visit(FlatFunctionValue&) override {
+    throw std::invalid_argument("Flat functions only run on a FlatInterpreter.");
+  }
 
   void visit(Var& el) override {
-    name = el.name;
+    name = el.symbol;
     if (callstack != nullptr) {
       auto ar = callstack->get(name);
       if (ar != nullptr) {
@@ -481,52 +932,12 @@ public:
   }
 
   void visit(UnaryOp& el) override {
-    el.node->accept(*this);
-    int nodeValue = value;
-    if (el.op.type == Token::Type::PLUS) {
-    } else if (el.op.type == Token::Type::MINUS) {
-      value = -nodeValue;
-    } else if (el.op.type == Token::Type::NOT) {
-      value = nodeValue != 1 ? 1 : 0;
-    } else {
-      throw std::invalid_argument("Invalid unary op.");
-    }
+    evaluate(el);
   }
 
   void visit(BinaryOp& el) override {
     // TODO: type check
-    el.left->accept(*this);
-    int leftValue = value;
-    // TODO: type check
-    el.right->accept(*this);
-    int rightValue = value;
-    if (el.op.type == Token::Type::PLUS) {
-      value = leftValue + rightValue;
-    } else if (el.op.type == Token::Type::MINUS) {
-      value = leftValue - rightValue;
-    } else if (el.op.type == Token::Type::MULTPLY) {
-      value = leftValue * rightValue;
-    } else if (el.op.type == Token::Type::DIVIDE) {
-      value = leftValue / rightValue;
-    } else if (el.op.type == Token::Type::OR) {
-      value = (leftValue == 1) || (rightValue == 1) ? 1 : 0;
-    } else if (el.op.type == Token::Type::AND) {
-      value = (leftValue == 1) && (rightValue == 1) ? 1 : 0;
-    } else if (el.op.type == Token::Type::EQUAL) {
-      value = leftValue == rightValue ? 1 : 0;
-    } else if (el.op.type == Token::Type::NOT_EQUAL) {
-      value = leftValue != rightValue ? 1 : 0;
-    } else if (el.op.type == Token::Type::GREATER) {
-      value = leftValue > rightValue ? 1 : 0;
-    } else if (el.op.type == Token::Type::GREATER_EQUAL) {
-      value = leftValue >= rightValue ? 1 : 0;
-    } else if (el.op.type == Token::Type::LESS) {
-      value = leftValue < rightValue ? 1 : 0;
-    } else if (el.op.type == Token::Type::LESS_EQUAL) {
-      value = leftValue <= rightValue ? 1 :0;
-    } else {
-      throw std::invalid_argument("Invalid binary op.");
-    }
+    evaluate(el);
   }
 
   void visit(Assign& el) override {
@@ -559,9 +970,7 @@ public:
   }
 
   void visit(Compound& el) override {
-    for (const auto& subEl : el.children) {
-      subEl->accept(*this);
-    }
+    runStatements(el);
   }
 
   void visit(NoOp& el) override {}
@@ -594,7 +1003,7 @@ public:
 //    }
 //    this.currentScope.define(functionSymbol);
     el.name->accept(*this);
-    std::string functionName = name;
+    Symbol functionName = name;
 
     callstack->set(functionName, el);
     // TODO: symbol table creation
@@ -643,18 +1052,218 @@ public:
 //    this.callStack.pop();
 //    return finalValue;
     el.name->accept(*this);
-    std::string callName = name;
+    Symbol callName = name;
     auto funcAST = callstack->get(callName);
+    if (funcAST == nullptr) {
+      throw std::invalid_argument("Undefined function " + symbols->name(callName) + ".");
+    }
     auto callAR = std::make_shared<ActivationRecord>(name, ActivationRecord::Type::FUNCTION, callstack->level, callstack);
     callstack = callAR;
     funcAST->accept(*this);
     // Return value:
     // TODO:
 //    callstack->get(RETURN_VALUE);
-    callstack->print();
+    callstack->print(*symbols);
     callstack = callstack->parent;
   }
 
+private:
+  std::vector<PendingOperator<AST*>> operators;
+  std::vector<PendingStatements<Compound*>> statements;
+
+  // Visits only the operands that are not operators themselves.
+  void evaluate(AST& expression);
+  // Visits only the statements that are not compound statements themselves.
+  void runStatements(Compound& compound);
+};
+
+// Keeps the tree of a program up to date while its text is edited. After an
+// edit, the program's FUNCTIONs whose tokens the edit did not touch are taken
+// over from the previous tree, found by where their tokens start and a hash of
+// those tokens, and only the rest of the program is parsed again. Reused
+// subtrees keep the offsets their tokens had when they were parsed.
+class IncrementalParser {
+private:
+  struct Function {
+    // Token span from FUNCTION to the end of the block.
+    size_t first;
+    size_t count;
+    uint64_t hash;
+    FunctionDecl* decl;
+  };
+
+  IncrementalLexer lexer;
+  // Functions of the current tree without syntax errors, by first token.
+  std::vector<Function> functions;
+  std::vector<Function> found;
+  std::shared_ptr<Arena> nodes;
+  std::shared_ptr<Diagnostics> diagnostics;
+  AST* tree = nullptr;
+  size_t reusedCount = 0;
+  size_t errorsBefore = 0;
+  // Arena bytes right after the last parse from scratch; trees that reuse
+  // functions keep the arenas of earlier trees alive, and once those hold too
+  // much garbage the next edit parses everything again.
+  size_t freshBytes = 0;
+
+  static uint64_t hash(const Token* tokens, size_t count);
+  void parse(bool reusing);
+  // Called by the parser at every FUNCTION of the program, and with the end of
+  // each one it parsed.
+  FunctionDecl* reusable(size_t first, size_t& end);
+  void parsed(size_t first, size_t end, FunctionDecl* decl);
+  friend class Parser;
+public:
+  explicit IncrementalParser(std::string text, std::shared_ptr<Interner> symbols = nullptr);
+  IncrementalParser(const IncrementalParser&) = delete;
+  IncrementalParser& operator=(const IncrementalParser&) = delete;
+
+  // Replaces removed characters at offset with inserted and reparses. If the
+  // new text does not lex, throws and leaves the document and tree unchanged.
+  void edit(size_t offset, size_t removed, const std::string& inserted);
+
+  AST* getTree() const { return tree; }
+  // Syntax errors of the current text; lexing errors throw instead.
+  const std::shared_ptr<Diagnostics>& getDiagnostics() const { return diagnostics; }
+  // How many FUNCTIONs the last parse took over from the tree before it.
+  size_t reused() const { return reusedCount; }
+  const std::string& getText() const { return lexer.getText(); }
+  const std::shared_ptr<Interner>& interner() const { return lexer.interner(); }
+  const std::shared_ptr<Arena>& arena() const { return nodes; }
+};
+
+// Runs a program on printer while it is still being parsed: a parser thread
+// hands the declarations and then each statement of the main block over a
+// queue holding at most capacity statements, and the calling thread runs them
+// as they arrive. All FUNCTIONs are declared before the first statement runs,
+// so calls to FUNCTIONs declared further down resolve. Leaves the globals in
+// printer.callstack and returns the whole program, as Parser::program() would.
+AST* runPipelined(Parser& parser, PrintVisitor& printer, size_t capacity = 64);
+
+// Flat AST
+
+// The same tree as the AST classes, kept as parallel arrays indexed by node
+// instead of as objects linked by pointers. Nodes are stored in pre-order, so
+// a plain loop over the indices visits them in order, and each node's
+// children are the index range [childStart[i], childStart[i + 1]) of
+// children. Every array is trivially copyable.
+class FlatTree {
+public:
+  typedef uint32_t Index;
+
+  enum Kind : uint8_t {
+    NUM,
+    BOOLEAN,
+    VAR,
+    UNARY_OP,
+    BINARY_OP,
+    PROGRAM,
+    COMPOUND,
+    BLOCK,
+    ASSIGN,
+    NO_OP,
+    VAR_DECL,
+    TYPE,
+    PARAM,
+    FUNCTION_DECL,
+    CALL
+  };
+
+  // Children, in the order the AST classes hold them:
+  //   UNARY_OP: node                 BINARY_OP: left, right
+  //   PROGRAM: name, block           BLOCK: declarations..., compound statement
+  //   ASSIGN: left, right            VAR_DECL and PARAM: var, type
+  //   FUNCTION_DECL: name, params..., block
+  //   CALL: name, actual params...   COMPOUND: statements...
+  std::vector<Kind> kinds;
+  // The operator of UNARY_OP and BINARY_OP, and the type keyword of TYPE.
+  std::vector<Token::Type> ops;
+  // NUM values, BOOLEAN as 0 or 1, and VAR symbols.
+  std::vector<int64_t> values;
+  std::vector<Index> childStart;
+  std::vector<Index> children;
+
+  static FlatTree fromTree(AST& root);
+
+  size_t size() const { return kinds.size(); }
+  const Index* childrenBegin(Index node) const { return children.data() + childStart[node]; }
+  const Index* childrenEnd(Index node) const { return children.data() + childStart[node + 1]; }
+  Index child(Index node, size_t i) const { return children[childStart[node] + i]; }
+  size_t childCount(Index node) const { return childStart[node + 1] - childStart[node]; }
+};
+
+// A function declared while running a FlatTree.
+class FlatFunctionValue: public RecordValue {
+public:
+  const FlatTree* tree;
+  FlatTree::Index node;
+  FlatFunctionValue(const FlatTree* tree, FlatTree::Index node): tree(tree), node(node) {}
+  void accept(RecordValueVisitor& v) override {
+    v.visit(*this);
+  }
+};
+
+// Runs a FlatTree with the same results and output as PrintVisitor, switching
+// on node kinds instead of dispatching through virtual calls.
+class FlatInterpreter: public RecordValueVisitor {
+private:
+  const FlatTree* tree = nullptr;
+  std::vector<PendingOperator<FlatTree::Index>> operators;
+  std::vector<PendingStatements<FlatTree::Index>> statements;
+
+  void run(FlatTree::Index node);
+  void evaluate(FlatTree::Index expression);
+  void runStatements(FlatTree::Index compound);
+public:
+  int64_t value = 0;
+  Symbol name = 0;
+  std::shared_ptr<ActivationRecord> callstack = nullptr;
+  std::shared_ptr<Interner> symbols;
+
+  explicit FlatInterpreter(std::shared_ptr<Interner> symbols): symbols(std::move(symbols)) {}
+
+  // Runs the PROGRAM at node 0 and prints its globals.
+  void runProgram(const FlatTree& program);
+  // Runs one node, e.g. a program's block with a callstack set up by the caller.
+  void run(const FlatTree& program, FlatTree::Index node);
+
+  void visit(NumberValue& val) override { value = val.value; }
+  void visit(BooleanValue& val) override { value = val.value ? 1 : 0; }
+  void visit(ASTValue&) override {
+    throw std::invalid_argument("Tree functions only run on a PrintVisitor.");
+  }
+  void visit(FlatFunctionValue& val) override {
+    run(val.tree->child(val.node, val.tree->childCount(val.node) - 1));
+  }
+};
+
+// A FlatTree saved to disk together with its identifier table, keyed by a hash
+// of the source it was parsed from (see TokenCache::hash()). Loading maps the
+// file and copies each array of the tree out of it in one pass, checking that
+// every node has the children its kind needs.
+class AstCache {
+private:
+  FlatTree tree;
+  std::shared_ptr<Interner> symbols;
+
+  AstCache() = default;
+  static std::shared_ptr<AstCache> load(const std::string& path, size_t sourceSize, uint64_t sourceHash);
+public:
+  // Bumped whenever the file layout, FlatTree::Kind or Token::Type changes.
+  static const uint32_t VERSION = 1;
+
+  // Returns nullptr when the file is missing, damaged, from another version,
+  // or was written for a different source.
+  static std::shared_ptr<AstCache> load(const std::string& path, const SourceBuffer& source);
+  // Returns false when the file could not be written.
+  static bool save(const std::string& path, const SourceBuffer& source, const FlatTree& tree, const Interner& symbols);
+  // Loads the cache for source from directory, parsing and saving it first
+  // when there is none yet. Returns nullptr when the program has errors or the
+  // cache can not be written; callers then parse normally.
+  static std::shared_ptr<AstCache> open(const std::string& directory, const SourceBuffer& source);
+
+  const FlatTree& getTree() const { return tree; }
+  const std::shared_ptr<Interner>& interner() const { return symbols; }
 };
 
 #endif //INTERPRETER_INTERPRETER_H
@@ -2,200 +2,383 @@
 #include<vector>
 #include<string>
 #include <iostream>
+#include <cstring>
 #include "interpreter.h"
+#include "scan.h"
 
-Lexer::Lexer(std::vector <std::string> lines) : lines(std::move(lines)) {}
+Lexer::Lexer(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols) : source(std::move(source)), symbols(std::move(symbols)), lookahead(LOOKAHEAD, Token(Token::Type::END_OF_FILE)) {
+  if (this->source->size() > UINT32_MAX) {
+    throw std::invalid_argument("Sources over 4 GB are not supported.");
+  }
+  cur = this->source->begin();
+  end = this->source->end();
+  base = cur;
+  kernels = &activeScanKernels();
+  if (this->symbols == nullptr) {
+    this->symbols = std::make_shared<Interner>();
+  }
+}
 
-bool Lexer::advance() {
-  if (line < lines.size()) {
-    if (pos + 1 < lines[line].size()) {
-      pos++;
-      return false;
-    } else {
-      line++;
-      pos = 0;
-    }
+Lexer::Lexer(std::shared_ptr<SourceStream> stream, std::shared_ptr<Interner> symbols, size_t chunkSize) : symbols(std::move(symbols)), stream(std::move(stream)), window(chunkSize), lookahead(LOOKAHEAD, Token(Token::Type::END_OF_FILE)) {
+  cur = end = base = window.data();
+  kernels = &activeScanKernels();
+  if (this->symbols == nullptr) {
+    this->symbols = std::make_shared<Interner>();
   }
-  if (line > lines.size()) {
-    throw "advance";
+}
+
+Lexer::Lexer(std::shared_ptr<const std::vector<Token>> tokens, std::shared_ptr<Interner> symbols) : symbols(std::move(symbols)), lookahead(LOOKAHEAD, Token(Token::Type::END_OF_FILE)) {
+  if (tokens->empty() || tokens->back().type != Token::Type::END_OF_FILE) {
+    throw std::invalid_argument("Token stream must end with END_OF_FILE.");
   }
-  return true;
+  replayBegin = replayCur = tokens->data();
+  replayEnd = tokens->data() + tokens->size();
+  replayOwner = std::move(tokens);
+  cur = end = base = nullptr;
+  kernels = &activeScanKernels();
+}
+
+Lexer::Lexer(std::shared_ptr<const TokenCache> cache) : symbols(cache->interner()), lookahead(LOOKAHEAD, Token(Token::Type::END_OF_FILE)) {
+  replayBegin = replayCur = cache->begin();
+  replayEnd = cache->end();
+  replayOwner = std::move(cache);
+  cur = end = base = nullptr;
+  kernels = &activeScanKernels();
+}
+
+Lexer::Lexer(Replay replay, std::shared_ptr<Interner> symbols) : symbols(std::move(symbols)), lookahead(LOOKAHEAD, Token(Token::Type::END_OF_FILE)) {
+  replayBegin = replayCur = replay.begin;
+  replayEnd = replay.end;
+  replayOwner = std::move(replay.owner);
+  cur = end = base = nullptr;
+  kernels = &activeScanKernels();
+}
+
+Lexer::Lexer(const std::vector<std::string>& lines) : Lexer(SourceBuffer::fromLines(lines)) {}
+
+void Lexer::advance() {
+  ++cur;
+}
+
+// Slides the streaming window past everything before keep and reads the next
+// chunk behind it, so a token that started in the previous chunk stays in one
+// piece. keep and cur are moved along with the window. Returns false once the
+// input is exhausted, and always for sources that are already fully in memory.
+bool Lexer::fill(const char*& keep) {
+  if (stream == nullptr) {
+    return false;
+  }
+  size_t kept = end - keep;
+  size_t curAt = cur - keep;
+  windowOffset += keep - base;
+  std::memmove(window.data(), keep, kept);
+  if (kept == window.size()) {
+    // A single token is longer than the window.
+    window.resize(window.size() * 2);
+  }
+  size_t count = stream->read(window.data() + kept, window.size() - kept);
+  if (diagnostics != nullptr) {
+    diagnostics->addLines(window.data() + kept, count);
+  }
+  base = window.data();
+  keep = base;
+  cur = base + curAt;
+  end = base + kept + count;
+  return count > 0;
 }
 
 void Lexer::skipComment() {
-  while (lines[line][pos] != '}') {
-    advance();
+  size_t start = offset(cur) - 1;
+  cur = kernels->commentEnd(cur, end);
+  while (isEmpty()) {
+    if (!fill(cur)) {
+      report(DiagnosticCode::UNTERMINATED_COMMENT, start, 1);
+      return;
+    }
+    cur = kernels->commentEnd(cur, end);
   }
   advance();
 }
 
 void Lexer::skipWhitespace() {
-  while(lines[line][pos] == ' ') {
-    advance();
+  if (isEmpty() || charClass(*cur) != CHAR_SPACE) {
+    return;
+  }
+  advance();
+  // Most runs are a single space between tokens, only hand longer ones to the vector kernels.
+  if (!isEmpty() && charClass(*cur) == CHAR_SPACE) {
+    cur = kernels->whitespace(cur, end);
   }
 }
 
 bool Lexer::isEmpty() {
-  return !(line < lines.size() && pos < lines[line].size());
+  return cur >= end;
 }
 
 void Lexer::print() {
-  std::cout << "Line: " << line << " Pos: " << pos << std::endl;
+  if (source == nullptr) {
+    std::cout << "Offset: " << offset(cur) << std::endl;
+    return;
+  }
+  int line = 0;
+  const char* lineStart = source->begin();
+  for (const char* c = source->begin(); c < cur; ++c) {
+    if (*c == '\n') {
+      line++;
+      lineStart = c + 1;
+    }
+  }
+  std::cout << "Line: " << line << " Pos: " << (cur - lineStart) << std::endl;
 }
 
 Token Lexer::getNextToken() {
-  while (!isEmpty()) {
-    char currentChar = lines[line][pos];
-
-    if (currentChar == ' ') {
-      skipWhitespace();
-      continue;
-    } else if (currentChar == '{') {
-      advance();
-      skipComment();
-      continue;
+  if (replayCur != nullptr) {
+    const Token* token = replayCur;
+    if (replayCur + 1 < replayEnd) {
+      replayCur++;
     }
+    return *token;
+  }
+  if (lookaheadCount > 0) {
+    Token token = std::move(lookahead[lookaheadStart]);
+    lookaheadStart = (lookaheadStart + 1) % LOOKAHEAD;
+    lookaheadCount--;
+    return token;
+  }
+  return scanToken();
+}
+
+Token Lexer::peek(const int & count) {
+  if (count < 1 || count > LOOKAHEAD) {
+    throw std::invalid_argument("Can not peek that far ahead.");
+  }
+  if (replayCur != nullptr) {
+    return replayCur + count - 1 < replayEnd ? replayCur[count - 1] : replayEnd[-1];
+  }
+  while (lookaheadCount < count) {
+    lookahead[(lookaheadStart + lookaheadCount) % LOOKAHEAD] = scanToken();
+    lookaheadCount++;
+  }
+  return lookahead[(lookaheadStart + count - 1) % LOOKAHEAD];
+}
+
+void Lexer::restart(size_t from, size_t to) {
+  if (source == nullptr || from > to || to > source->size()) {
+    throw std::invalid_argument("Can not restart the lexer there.");
+  }
+  cur = source->begin() + from;
+  end = source->begin() + to;
+  lookaheadStart = 0;
+  lookaheadCount = 0;
+}
 
-    if (isDigit(currentChar)) {
-        return number();
-    } else if (std::isalpha(currentChar) != 0) {
-      return _id();
+size_t Lexer::mark() {
+  if (replayCur != nullptr) {
+    return replayCur - replayBegin;
+  }
+  if (source == nullptr) {
+    throw std::invalid_argument("Streams can not be marked.");
+  }
+  return peek().offset;
+}
+
+void Lexer::resume(size_t mark) {
+  if (replayCur != nullptr) {
+    if (mark >= static_cast<size_t>(replayEnd - replayBegin)) {
+      throw std::invalid_argument("Can not resume the lexer there.");
     }
+    replayCur = replayBegin + mark;
+    return;
+  }
+  restart(mark, source != nullptr ? source->size() : 0);
+}
 
-    if (currentChar == '+') {
-      advance();
-      Token token = Token(Token::Type::PLUS);
-      return token;
-    } else if (currentChar == '-') {
-      advance();
-      Token token = Token(Token::Type::MINUS);
-      return token;
-    } else if (currentChar == '*') {
-      advance();
-      Token token = Token(Token::Type::MULTPLY);
-      return token;
-    } else if (currentChar == '/') {
-      advance();
-      Token token = Token(Token::Type::DIVIDE);
-      return token;
-    } else if (currentChar == '(') {
-      advance();
-      Token token = Token(Token::Type::LEFT_PAREN);
-      return token;
-    } else if (currentChar == ')') {
-      advance();
-      Token token = Token(Token::Type::RIGHT_PAREN);
-      return token;
-    } else if (currentChar == ';') {
-      advance();
-      Token token = Token(Token::Type::SEMI);
-      return token;
-    } else if (currentChar == '.') {
-      advance();
-      Token token = Token(Token::Type::DOT);
-      return token;
-    } else if (currentChar == ',') {
-      advance();
-      Token token = Token(Token::Type::COMMA);
-      return token;
-    } else if (currentChar == '!') {
-      advance();
-      if (lines[line][pos] == '=') {
-        advance();
-        Token token = Token(Token::Type::NOT_EQUAL);
-        return token;
-      }
-      Token token = Token(Token::Type::NOT);
-      return token;
-    } else if (currentChar == '=' && peekChar() == '=') {
-      advance();
-      advance();
-      Token token = Token(Token::Type::EQUAL);
-      return token;
-    } else if (currentChar == ':') {
-      advance();
-      if (lines[line][pos] == '=') {
-        advance();
-        Token token = Token(Token::Type::ASSIGN);
-        return token;
-      }
-      Token token = Token(Token::Type::COLON);
-      return token;
-    } else if (currentChar == '<') {
-      advance();
-      if (lines[line][pos] == '=') {
+void Lexer::setDiagnostics(std::shared_ptr<Diagnostics> diagnostics) {
+  this->diagnostics = std::move(diagnostics);
+}
+
+void Lexer::report(DiagnosticCode code, size_t offset, size_t length, Token::Type expected, Token::Type found) {
+  if (diagnostics == nullptr) {
+    throw std::invalid_argument(std::string(diagnosticMessage(code)) + " at offset " + std::to_string(offset) + ".");
+  }
+  // In-memory sources are only scanned for lines once they turn out to have an error.
+  if (source != nullptr && !diagnostics->hasLines()) {
+    diagnostics->addLines(source->begin(), source->size());
+  }
+  diagnostics->report({code, expected, found, static_cast<uint32_t>(offset), static_cast<uint32_t>(length)});
+}
+
+void Lexer::countScans(bool enabled) {
+  countingScans = enabled;
+  if (enabled) {
+    scans.assign(source != nullptr ? source->size() : 0, 0);
+  } else {
+    scans.clear();
+  }
+}
+
+// Lexes one token from the source and, when enabled, records which characters it covered.
+Token Lexer::scanToken() {
+  if (!countingScans) {
+    return lexToken();
+  }
+  size_t start = offset(cur);
+  Token token = lexToken();
+  size_t stop = offset(cur);
+  if (scans.size() < stop) {
+    scans.resize(stop, 0);
+  }
+  for (size_t i = start; i < stop; ++i) {
+    scans[i]++;
+  }
+  return token;
+}
+
+Token Lexer::lexToken() {
+  while (!isEmpty() || fill(cur)) {
+    size_t start = offset(cur);
+    Token token (Token::Type::END_OF_FILE);
+    switch (charClass(*cur)) {
+      case CHAR_SPACE:
+        skipWhitespace();
+        continue;
+      case CHAR_COMMENT:
         advance();
-        Token token = Token(Token::Type::LESS_EQUAL);
-        return token;
-      }
-      Token token = Token(Token::Type::LESS);
-      return token;
-    } else if (currentChar == '>') {
-      advance();
-      if (lines[line][pos] == '=') {
+        skipComment();
+        continue;
+      case CHAR_DIGIT:
+        token = number();
+        break;
+      case CHAR_LETTER:
+        token = _id();
+        break;
+      case CHAR_OPERATOR:
+        token = operatorToken();
+        if (token.type == Token::Type::END_OF_FILE) {
+          // An invalid operator, which was reported and skipped.
+          continue;
+        }
+        break;
+      case CHAR_INVALID:
+        report(DiagnosticCode::INVALID_CHARACTER, start, 1);
         advance();
-        Token token = Token(Token::Type::GREATER_EQUAL);
-        return token;
-      }
-      Token token = Token(Token::Type::GREATER);
-      return token;
-    } else if (currentChar == '&' && this->peekChar() == '&') {
-      advance();
-      advance();
-      return Token(Token::Type::AND);
-    } else if (currentChar == '|' && this->peekChar() == '|') {
-      advance();
-      advance();
-      return Token(Token::Type::OR);
+        continue;
     }
-
-    throw std::invalid_argument("Invalid token.");
+    size_t length = offset(cur) - start;
+    if (length > Token::MAX_LENGTH) {
+      report(DiagnosticCode::TOKEN_TOO_LONG, start, length);
+      length = Token::MAX_LENGTH;
+    }
+    token.offset = static_cast<uint32_t>(start);
+    token.length = static_cast<uint16_t>(length);
+    return token;
   }
   Token token = Token(Token::Type::END_OF_FILE);
+  token.offset = static_cast<uint32_t>(offset(cur));
   return token;
 }
 
-Token Lexer::peek(const int & count) {
-  const int oldLine = line;
-  const int oldPos = pos;
-  Token token = getNextToken();
-
-  for (int i = 1; i < count; ++i) {
-    token = getNextToken();
-  }
+// Operators are at most two characters long, so they are lexed by a two state DFA:
+// the first character selects a row, and the row says which second character
+// (if any) extends it into a longer operator.
+struct OperatorState {
+  bool accepts;
+  Token::Type single;
+  char next;
+  Token::Type pair;
+};
 
-  line = oldLine;
-  pos = oldPos;
+static const OperatorState OPERATOR_STATES[] = {
+    {false, Token::Type::END_OF_FILE, '\0', Token::Type::END_OF_FILE},
+    {true, Token::Type::PLUS, '\0', Token::Type::END_OF_FILE},         // +
+    {true, Token::Type::MINUS, '\0', Token::Type::END_OF_FILE},        // -
+    {true, Token::Type::MULTPLY, '\0', Token::Type::END_OF_FILE},      // *
+    {true, Token::Type::DIVIDE, '\0', Token::Type::END_OF_FILE},       // /
+    {true, Token::Type::LEFT_PAREN, '\0', Token::Type::END_OF_FILE},   // (
+    {true, Token::Type::RIGHT_PAREN, '\0', Token::Type::END_OF_FILE},  // )
+    {true, Token::Type::SEMI, '\0', Token::Type::END_OF_FILE},         // ;
+    {true, Token::Type::DOT, '\0', Token::Type::END_OF_FILE},          // .
+    {true, Token::Type::COMMA, '\0', Token::Type::END_OF_FILE},        // ,
+    {true, Token::Type::NOT, '=', Token::Type::NOT_EQUAL},             // ! !=
+    {false, Token::Type::END_OF_FILE, '=', Token::Type::EQUAL},        // ==
+    {true, Token::Type::COLON, '=', Token::Type::ASSIGN},              // : :=
+    {true, Token::Type::LESS, '=', Token::Type::LESS_EQUAL},           // < <=
+    {true, Token::Type::GREATER, '=', Token::Type::GREATER_EQUAL},     // > >=
+    {false, Token::Type::END_OF_FILE, '&', Token::Type::AND},          // &&
+    {false, Token::Type::END_OF_FILE, '|', Token::Type::OR},           // ||
+};
 
-  return token;
-}
+// Start transitions of the operator DFA, indexed by the first character.
+static const unsigned char OPERATOR_START[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0, 10,  0,  0,  0,  0, 15,  0,  5,  6,  3,  1,  9,  2,  8,  4,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 12,  7, 13, 11, 14,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
 
-Token Lexer::number() {
-  std::string num;
-  while (!isEmpty() && isDigit(lines[line][pos])) {
-    num += lines[line][pos];
+Token Lexer::operatorToken() {
+  const char* start = cur;
+  const OperatorState& state = OPERATOR_STATES[OPERATOR_START[static_cast<unsigned char>(*cur)]];
+  advance();
+  if (state.next != '\0' && (!isEmpty() || fill(start)) && *cur == state.next) {
     advance();
+    return Token(state.pair);
   }
-  Token token (Token::Type::INTEGER_CONST, std::stoi(num));
-  return token;
+  if (!state.accepts) {
+    report(DiagnosticCode::INVALID_OPERATOR, offset(start), cur - start);
+    return Token(Token::Type::END_OF_FILE);
+  }
+  return Token(state.single);
 }
 
-char Lexer::peekChar() {
-  if (line < lines.size() && pos + 1 < lines[line].size()) {
-    return lines[line][pos + 1];
+// Digits are accumulated as they are scanned, so a literal never allocates.
+Token Lexer::number() {
+  const char* start = cur;
+  uint64_t value = 0;
+  bool overflow = false;
+  do {
+    while (!isEmpty() && isDigit(*cur)) {
+      unsigned digit = *cur - '0';
+      if (value > (static_cast<uint64_t>(INT64_MAX) - digit) / 10) {
+        overflow = true;
+      } else {
+        value = value * 10 + digit;
+      }
+      advance();
+    }
+  } while (isEmpty() && fill(start));
+  if (overflow) {
+    report(DiagnosticCode::INTEGER_OUT_OF_RANGE, offset(start), cur - start);
+    value = INT64_MAX;
+  }
+  Token token (Token::Type::INTEGER_CONST, static_cast<int64_t>(value));
+  if (value > INT32_MAX) {
+    token.flags |= Token::WIDE;
   }
-  throw std::invalid_argument("Can not peek character.");
+  return token;
 }
 
 Token Lexer::_id() {
-  std::string result;
-  while (!isEmpty() && std::isalnum(lines[line][pos]) != 0) {
-    result += lines[line][pos];
-    if (advance()) break;
+  const char* start = cur;
+  cur = kernels->identifier(cur, end);
+  while (isEmpty() && fill(start)) {
+    cur = kernels->identifier(cur, end);
   }
-  // TODO: uppercase
-  if (RESERVED_KEYWORDS.find(result) != RESERVED_KEYWORDS.end()) {
-    return RESERVED_KEYWORDS.at(result);
+  Token::Type type = keywordType(start, cur - start);
+  if (type == Token::Type::ID) {
+    return Token(symbols->intern(start, cur - start), Token::Type::ID);
   }
-  return Token(result, Token::Type::ID, 0);
+  return Token(type, type == Token::Type::TRUE ? 1 : 0);
 }
@@ -1,36 +1,182 @@
 #include "interpreter.h"
-#include<vector>
+#include<cctype>
 #include<iostream>
-#include<fstream>
+#include<limits>
 
-std::vector<std::string> readLines(const std::string& filename) {
-  std::vector<std::string> lines;
-  std::ifstream file (filename);
-  std::string line;
-  while(std::getline(file, line)) {
-    // TODO: remove tabs
-    lines.push_back(line);
+static void usage(std::ostream& out, const char* program) {
+  out << "Usage: " << program << " [--token-cache directory] [--ast-cache directory] [--flat] [--lazy-functions] [--pipeline] [--hash-cons] [--threads count] [--max-depth count] (file.pas | -)" << std::endl;
+}
+
+// Parses a whole argument as a count no larger than max.
+static bool parseCount(const std::string& text, unsigned long long max, unsigned long long& count) {
+  if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0]))) {
+    return false;
   }
-  return lines;
+  size_t used = 0;
+  try {
+    count = std::stoull(text, &used);
+  } catch (const std::exception&) {
+    return false;
+  }
+  return used == text.size() && count <= max;
 }
 
-int main() {
-  auto lines = readLines(R"(C:\Users\kpfro\CLionProjects\Interpreter\programs\first.pas)");
-//  std::vector<std::string> lines;
-//  lines.emplace_back("PROGRAM test; BEGIN x:=3; x:=x*x+x; y := (x+3)/3 END.");
+int main(int argc, char* argv[]) {
+  std::string filename;
+  std::string tokenCache;
+  std::string astCache;
+  bool flat = false;
+  bool lazy = false;
+  bool pipeline = false;
+  bool hashCons = false;
+  bool parallel = false;
+  unsigned threads = 0;
+  size_t maxDepth = 0;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      usage(std::cout, argv[0]);
+      std::cout << "Reads the program from standard input when the file is -." << std::endl;
+      std::cout << "--token-cache keeps lexed files in directory and reuses them while the file is unchanged." << std::endl;
+      std::cout << "--ast-cache keeps flattened trees of files in directory and runs them while the file is unchanged." << std::endl;
+      std::cout << "--flat runs the program from a flattened copy of its tree." << std::endl;
+      std::cout << "--lazy-functions parses each function body the first time it is called." << std::endl;
+      std::cout << "--pipeline runs each statement of the main block while the rest of the program is still being parsed." << std::endl;
+      std::cout << "--hash-cons shares one tree node between equal literals, variables and operator trees." << std::endl;
+      std::cout << "--threads lexes a file and parses its function bodies on count threads, 0 for every core." << std::endl;
+      std::cout << "--max-depth parses without recursion and rejects programs nested more than count levels deep." << std::endl;
+      return 0;
+    } else if (arg == "--flat") {
+      flat = true;
+    } else if (arg == "--lazy-functions") {
+      lazy = true;
+    } else if (arg == "--pipeline") {
+      pipeline = true;
+    } else if (arg == "--hash-cons") {
+      hashCons = true;
+    } else if (arg == "--threads" || arg == "--max-depth" || arg == "--token-cache" || arg == "--ast-cache") {
+      if (i + 1 >= argc) {
+        std::cerr << arg << " needs a value." << std::endl;
+        usage(std::cerr, argv[0]);
+        return 1;
+      }
+      std::string value = argv[++i];
+      unsigned long long count = 0;
+      if (arg == "--token-cache") {
+        tokenCache = value;
+      } else if (arg == "--ast-cache") {
+        astCache = value;
+      } else if (!parseCount(value, arg == "--threads" ? std::numeric_limits<unsigned>::max() : std::numeric_limits<size_t>::max(), count)) {
+        std::cerr << arg << " needs a count, not " << value << "." << std::endl;
+        usage(std::cerr, argv[0]);
+        return 1;
+      } else if (arg == "--threads") {
+        parallel = true;
+        threads = static_cast<unsigned>(count);
+      } else {
+        maxDepth = static_cast<size_t>(count);
+      }
+    } else {
+      filename = arg;
+    }
+  }
+  if (filename.empty()) {
+    usage(std::cerr, argv[0]);
+    return 1;
+  }
 
 //  std::cout << "Start" << std::endl;
-//  Lexer lexer (lines);
+//  Lexer lexer (SourceBuffer::fromFile(filename));
 //  for (Token token = lexer.getNextToken(); token.type != Token::Type::END_OF_FILE; token = lexer.getNextToken()) {
 //    std::cout << token.value << std::endl;
 //  }
 
-  PrintVisitor printer;
+  // Programs piped in are lexed as they arrive instead of being read up front.
+  std::shared_ptr<SourceBuffer> source;
+  std::unique_ptr<Parser> parser;
+  if (filename == "-") {
+    parser.reset(new Parser(std::make_shared<SourceStream>(0)));
+  } else {
+    source = SourceBuffer::fromFile(filename);
+    // A cached tree skips lexing and parsing altogether. Programs with errors
+    // are never cached and fall through to report them below.
+    if (auto cached = astCache.empty() ? nullptr : AstCache::open(astCache, *source)) {
+      FlatInterpreter interpreter (cached->interner());
+      interpreter.runProgram(cached->getTree());
+      std::cout << interpreter.value << std::endl;
+      return 0;
+    }
+    auto cache = tokenCache.empty() ? nullptr : TokenCache::open(tokenCache, *source);
+    if (cache != nullptr) {
+      parser.reset(new Parser(cache));
+    } else if (parallel) {
+      // Lexing errors throw here; the serial parser below reports them properly.
+      try {
+        auto symbols = std::make_shared<Interner>();
+        auto tokens = std::make_shared<const std::vector<Token>>(tokenizeParallel(source, symbols, threads));
+        parser.reset(new Parser(tokens, symbols));
+      } catch (const std::invalid_argument&) {
+      }
+    }
+    if (parser == nullptr) {
+      parser.reset(new Parser(source));
+    }
+  }
+  auto diagnostics = std::make_shared<Diagnostics>();
+  parser->setDiagnostics(diagnostics);
+  parser->setLazyFunctions(lazy);
+  parser->setParallelFunctions(parallel, threads);
+  parser->setHashConsing(hashCons);
+  if (maxDepth > 0) {
+    parser->setIterative(true, maxDepth);
+  }
+  auto failed = [&]() {
+    if (diagnostics->empty()) {
+      return false;
+    }
+    // Cached tokens come without their text.
+    if (source != nullptr && !diagnostics->hasLines()) {
+      diagnostics->addLines(source->begin(), source->size());
+    }
+    diagnostics->print(std::cerr, filename == "-" ? "<stdin>" : filename);
+    return true;
+  };
 
-  Parser parser (lines);
-  parser.program()->accept(printer);
+  // Statements run before a later syntax error is found, but nothing is printed then.
+  if (pipeline) {
+    PrintVisitor printer (parser->interner());
+    runPipelined(*parser, printer);
+    if (failed()) {
+      return 1;
+    }
+    printer.print();
+    std::cout << printer.value << std::endl;
+    return 0;
+  }
+
+  auto tree = parser->program();
+  if (failed()) {
+    return 1;
+  }
+
+  // Lazily parsed function bodies report their errors while the program runs.
+  if (flat) {
+    FlatInterpreter interpreter (parser->interner());
+    interpreter.runProgram(FlatTree::fromTree(*tree));
+    if (failed()) {
+      return 1;
+    }
+    std::cout << interpreter.value << std::endl;
+    return 0;
+  }
+
+  PrintVisitor printer (parser->interner());
+  tree->accept(printer);
+  if (failed()) {
+    return 1;
+  }
 
   printer.print();
 
   std::cout << printer.value << std::endl;
-}
\ No newline at end of file
+}
@@ -0,0 +1,150 @@
+#include <utility>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <limits>
+#include "interpreter.h"
+#include "thread-pool.h"
+
+std::vector<Token> tokenize(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols) {
+  Lexer lexer(std::move(source), std::move(symbols));
+  std::vector<Token> tokens;
+  for (Token token = lexer.getNextToken();; token = lexer.getNextToken()) {
+    tokens.push_back(token);
+    if (token.type == Token::Type::END_OF_FILE) {
+      return tokens;
+    }
+  }
+}
+
+// Chunks are cut at whitespace, but a chunk may still begin inside a comment
+// that an earlier chunk opened. Each chunk is therefore lexed speculatively, as
+// if it began between two tokens, with its own interner. Lexing stops at the
+// first token that starts at or after the chunk's limit, which may be past the
+// limit when a comment runs across it.
+struct LexedChunk {
+  size_t from;
+  size_t limit;
+  std::vector<Token> tokens;
+  std::shared_ptr<Interner> symbols;
+  // Start of the first token not included, i.e. where the next chunk has to resume.
+  size_t resume;
+  // Set when lexing failed after the last token in tokens.
+  std::exception_ptr error;
+};
+
+static void lexChunk(const std::shared_ptr<SourceBuffer>& source, LexedChunk& chunk) {
+  chunk.symbols = std::make_shared<Interner>();
+  Lexer lexer(source, chunk.symbols);
+  lexer.restart(chunk.from, source->size());
+  try {
+    while (true) {
+      Token token = lexer.getNextToken();
+      if (token.offset >= chunk.limit || token.type == Token::Type::END_OF_FILE) {
+        chunk.resume = token.offset;
+        return;
+      }
+      chunk.tokens.push_back(token);
+    }
+  } catch (...) {
+    chunk.error = std::current_exception();
+    chunk.resume = std::numeric_limits<size_t>::max();
+  }
+}
+
+// Picks chunk boundaries close to even splits, moved forward to the next whitespace.
+static std::vector<size_t> chunkBoundaries(const SourceBuffer& source, size_t chunks) {
+  std::vector<size_t> boundaries = {0};
+  size_t step = source.size() / chunks;
+  for (size_t i = 1; i < chunks; ++i) {
+    size_t at = std::max(i * step, boundaries.back() + 1);
+    while (at < source.size() && charClass(source.begin()[at]) != CHAR_SPACE) {
+      at++;
+    }
+    if (at >= source.size()) {
+      break;
+    }
+    boundaries.push_back(at);
+  }
+  boundaries.push_back(source.size());
+  return boundaries;
+}
+
+std::vector<Token> tokenizeParallel(std::shared_ptr<SourceBuffer> source, std::shared_ptr<Interner> symbols, unsigned threads) {
+  const size_t MIN_CHUNK = 64 * 1024;
+  ThreadPool pool(threads);
+  size_t chunkCount = std::min<size_t>(pool.size() * 4, source->size() / MIN_CHUNK);
+  if (chunkCount < 2) {
+    return tokenize(source, symbols);
+  }
+
+  std::vector<size_t> boundaries = chunkBoundaries(*source, chunkCount);
+  std::vector<LexedChunk> chunks(boundaries.size() - 1);
+  std::vector<std::future<void>> pending;
+  pending.reserve(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    chunks[i].from = boundaries[i];
+    chunks[i].limit = boundaries[i + 1];
+    LexedChunk* chunk = &chunks[i];
+    pending.push_back(pool.submit([source, chunk]() { lexChunk(source, *chunk); }));
+  }
+  for (auto& done : pending) {
+    done.get();
+  }
+
+  // Stitch the chunks together in order. resume is where the real token stream
+  // continues; a chunk whose speculative tokens include a token starting there
+  // agrees with the serial lexer from that token on. Otherwise it guessed wrong
+  // (it started inside a comment) and is lexed again from resume.
+  std::vector<Token> tokens;
+  std::vector<std::pair<std::shared_ptr<Interner>, size_t>> origins;
+  size_t resume = 0;
+  for (auto& chunk : chunks) {
+    if (resume >= chunk.limit) {
+      continue;
+    }
+    auto first = std::lower_bound(chunk.tokens.begin(), chunk.tokens.end(), resume, [](const Token& token, size_t offset) {
+      return token.offset < offset;
+    });
+    bool agrees = first != chunk.tokens.end() ? first->offset == resume : chunk.resume == resume;
+    if (!agrees) {
+      LexedChunk redo;
+      redo.from = resume;
+      redo.limit = chunk.limit;
+      lexChunk(source, redo);
+      chunk = std::move(redo);
+      first = chunk.tokens.begin();
+    }
+    if (chunk.error) {
+      std::rethrow_exception(chunk.error);
+    }
+    origins.emplace_back(chunk.symbols, tokens.size());
+    tokens.insert(tokens.end(), first, chunk.tokens.end());
+    resume = chunk.resume;
+  }
+  Token eof(Token::Type::END_OF_FILE);
+  eof.offset = static_cast<uint32_t>(source->size());
+  tokens.push_back(eof);
+
+  // Rename every chunk's symbols into the shared interner, in token order, so
+  // symbols are numbered exactly as the serial lexer would number them. A
+  // chunk's interner may have first seen a symbol in a dropped speculative
+  // token, so the spelling is taken from the kept token's own text.
+  origins.emplace_back(nullptr, tokens.size() - 1);
+  for (size_t i = 0; i + 1 < origins.size(); ++i) {
+    const Interner& local = *origins[i].first;
+    std::vector<Symbol> renamed(local.size(), std::numeric_limits<Symbol>::max());
+    for (size_t t = origins[i].second; t < origins[i + 1].second; ++t) {
+      Token& token = tokens[t];
+      if (token.type != Token::Type::ID) {
+        continue;
+      }
+      Symbol& global = renamed[token.symbol];
+      if (global == std::numeric_limits<Symbol>::max()) {
+        global = symbols->intern(source->begin() + token.offset, token.length);
+      }
+      token.symbol = global;
+    }
+  }
+  return tokens;
+}
@@ -1,34 +1,225 @@
 #include "interpreter.h"
+#include "thread-pool.h"
+#include <algorithm>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
-Parser::Parser(std::vector<std::string> lines): lexer(std::move(lines)) {}
+Parser::Parser(std::shared_ptr<SourceBuffer> source): lexer(std::move(source)), nodes(std::make_shared<Arena>()) {}
+
+Parser::Parser(std::shared_ptr<SourceStream> stream): lexer(std::move(stream)), nodes(std::make_shared<Arena>()) {}
+
+Parser::Parser(std::shared_ptr<const std::vector<Token>> tokens, std::shared_ptr<Interner> symbols): lexer(std::move(tokens), std::move(symbols)), nodes(std::make_shared<Arena>()) {}
+
+Parser::Parser(std::shared_ptr<const TokenCache> cache): lexer(std::move(cache)), nodes(std::make_shared<Arena>()) {}
+
+Parser::Parser(const std::vector<std::string>& lines): lexer(lines), nodes(std::make_shared<Arena>()) {}
+
+Parser::Parser(Lexer::Replay replay, std::shared_ptr<Interner> symbols): lexer(std::move(replay), std::move(symbols)), nodes(std::make_shared<Arena>()) {}
+
+// Open addressed like the Interner, at most three quarters full. Each slot is
+// a node and a tag holding the node's kind and operator and a few bits of its
+// hash, with zero for an empty slot; the tags sit in an array of their own, so
+// a probe only looks at a node when its tag matches. Both arrays live in an
+// arena of the table's own, freed with it. While parallel bodies are parsed,
+// their parsers share their parent's table and take its lock.
+class Parser::ConsTable {
+private:
+  static_assert(Token::Type::END_OF_FILE < 64, "Tags have six bits for the operator.");
+  size_t mask = 63;
+  size_t count = 0;
+  Arena arena;
+  uint16_t* tags;
+  AST** slots;
+
+  template <typename T>
+  T* emptyArray(size_t size) {
+    auto array = static_cast<T*>(arena.allocate(size * sizeof(T), alignof(T)));
+    std::fill(array, array + size, T());
+    return array;
+  }
+
+  static uint64_t hash(const ConsKey& key) {
+    const uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = (static_cast<uint64_t>(key.kind) << 8 | key.op) * MULTIPLIER;
+    h = (h ^ static_cast<uint64_t>(key.value)) * MULTIPLIER;
+    h = (h ^ reinterpret_cast<uintptr_t>(key.left)) * MULTIPLIER;
+    h = (h ^ reinterpret_cast<uintptr_t>(key.right)) * MULTIPLIER;
+    return h ^ (h >> 32);
+  }
+
+  static uint16_t tag(const ConsKey& key, uint64_t hash) {
+    return static_cast<uint16_t>(0x8000 | key.kind << 12 | key.op << 6 | hash >> 58);
+  }
+
+  // The tag settles the kind and operator; the rest is on the node.
+  static bool holds(const AST* node, const ConsKey& key) {
+    switch (key.kind) {
+    case ConsKey::NUM:
+      return static_cast<const Num*>(node)->value == key.value;
+    case ConsKey::VAR:
+      return static_cast<const Var*>(node)->symbol == key.value;
+    case ConsKey::UNARY_OP:
+      return static_cast<const UnaryOp*>(node)->node == key.left;
+    case ConsKey::BINARY_OP: {
+      auto op = static_cast<const BinaryOp*>(node);
+      return op->left == key.left && op->right == key.right;
+    }
+    default:
+      return true;
+    }
+  }
+
+  static ConsKey keyOf(uint16_t tag, const AST* node) {
+    ConsKey key {static_cast<ConsKey::Kind>(tag >> 12 & 7), static_cast<Token::Type>(tag >> 6 & 0x3f), 0, nullptr, nullptr};
+    switch (key.kind) {
+    case ConsKey::NUM:
+      key.value = static_cast<const Num*>(node)->value;
+      break;
+    case ConsKey::VAR:
+      key.value = static_cast<const Var*>(node)->symbol;
+      break;
+    case ConsKey::UNARY_OP:
+      key.left = static_cast<const UnaryOp*>(node)->node;
+      break;
+    case ConsKey::BINARY_OP:
+      key.left = static_cast<const BinaryOp*>(node)->left;
+      key.right = static_cast<const BinaryOp*>(node)->right;
+      break;
+    default:
+      break;
+    }
+    return key;
+  }
+
+  void grow() {
+    size_t size = (mask + 1) * 2;
+    auto largerTags = emptyArray<uint16_t>(size);
+    auto largerSlots = emptyArray<AST*>(size);
+    for (size_t i = 0; i <= mask; ++i) {
+      if (tags[i] != 0) {
+        size_t j = hash(keyOf(tags[i], slots[i])) & (size - 1);
+        while (largerTags[j] != 0) {
+          j = (j + 1) & (size - 1);
+        }
+        largerTags[j] = tags[i];
+        largerSlots[j] = slots[i];
+      }
+    }
+    tags = largerTags;
+    slots = largerSlots;
+    mask = size - 1;
+  }
+public:
+  std::mutex lock;
+  bool shared = false;
+
+  ConsTable(): arena(16 * 1024), tags(emptyArray<uint16_t>(mask + 1)), slots(emptyArray<AST*>(mask + 1)) {}
+
+  // The node made earlier for key, or else the one make() returns, which is
+  // remembered for next time.
+  template <typename Make>
+  AST* intern(const ConsKey& key, Make make) {
+    uint64_t h = hash(key);
+    uint16_t wanted = tag(key, h);
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+      if (tags[i] == 0) {
+        AST* node = make();
+        tags[i] = wanted;
+        slots[i] = node;
+        if (++count * 4 > (mask + 1) * 3) {
+          grow();
+        }
+        return node;
+      }
+      if (tags[i] == wanted && holds(slots[i], key)) {
+        return slots[i];
+      }
+    }
+  }
+};
+
+template <typename T, typename... Args>
+AST* Parser::makeShared(const ConsKey& key, Args&&... args) {
+  if (!hashConsing) {
+    return nodes->make<T>(std::forward<Args>(args)...);
+  }
+  if (consed == nullptr) {
+    consed = std::make_shared<ConsTable>();
+  }
+  auto make = [&]() -> AST* { return nodes->make<T>(std::forward<Args>(args)...); };
+  if (consed->shared) {
+    std::lock_guard<std::mutex> guard(consed->lock);
+    return consed->intern(key, make);
+  }
+  return consed->intern(key, make);
+}
+
+// A missing token is reported and left unconsumed; the caller carries on as if
+// it had been there.
+NodeList Parser::takeList(size_t from) {
+  NodeList list(*nodes, pending.data() + from, pending.size() - from);
+  pending.resize(from);
+  return list;
+}
 
 Token Parser::eat(Token::Type type) {
-  Token token = lexer.getNextToken();
+  Token token = lexer.peek();
   if (token.type != type) {
-    throw std::invalid_argument("Invalid token type for eatting.");
+    fail(DiagnosticCode::UNEXPECTED_TOKEN, token, type);
+    Token missing(type);
+    missing.offset = token.offset;
+    return missing;
+  }
+  return lexer.getNextToken();
+}
+
+void Parser::fail(DiagnosticCode code, const Token& at, Token::Type expected) {
+  if (panicking) {
+    return;
   }
-  return token;
+  lexer.report(code, at.offset, at.length, expected, at.type);
+  panicking = true;
 }
 
-std::shared_ptr<AST> Parser::number() {
+// Panic mode recovery: skips to the end of the current statement, keeping
+// nested BEGIN ... END blocks balanced.
+void Parser::synchronize() {
+  int depth = 0;
+  for (Token::Type type = lexer.peek().type; type != Token::Type::END_OF_FILE; type = lexer.peek().type) {
+    if (depth == 0 && (type == Token::Type::SEMI || type == Token::Type::END || type == Token::Type::DOT)) {
+      break;
+    }
+    if (type == Token::Type::BEGIN) {
+      depth++;
+    } else if (type == Token::Type::END) {
+      depth--;
+    }
+    lexer.getNextToken();
+  }
+  panicking = false;
+}
+
+AST* Parser::number() {
   Token num = eat(Token::Type::INTEGER_CONST);
 //  std::cout << "Number: " << num.value << std::endl;
-  return std::shared_ptr<AST>(new Num(num.value));
+  return makeShared<Num>({ConsKey::NUM, Token::Type::INTEGER_CONST, num.value, nullptr, nullptr}, num.value);
 }
 
-std::shared_ptr<AST> Parser::boolean() {
-  Token boolean = lexer.getNextToken();
+AST* Parser::boolean() {
+  Token boolean = lexer.peek();
   if (boolean.type != Token::Type::TRUE && boolean.type != Token::Type::FALSE) {
-    throw std::invalid_argument("Invalid Boolean.");
+    fail(DiagnosticCode::EXPECTED_EXPRESSION, boolean);
+    return empty();
   }
-  return std::shared_ptr<AST>(new Boolean(boolean.type == Token::Type::TRUE));
+  lexer.getNextToken();
+  return makeShared<Boolean>({ConsKey::BOOLEAN, boolean.type, 0, nullptr, nullptr}, boolean.type == Token::Type::TRUE);
 }
-std::shared_ptr<AST> Parser::variable() {
+AST* Parser::variable() {
   Token var = eat(Token::Type::ID);
-  return std::shared_ptr<AST>(new Var(var.name));
+  return makeShared<Var>({ConsKey::VAR, Token::Type::ID, var.symbol, nullptr, nullptr}, var.symbol);
 }
 // factor: PLUS factor
 //       | MINUS factor
@@ -40,12 +231,14 @@ std::shared_ptr<AST> Parser::variable() {
 //       | LEFT_PAREN expr RIGHT_PAREN
 //       | variable
 //       | callStatement
-std::shared_ptr<AST> Parser::factor() {
+AST* Parser::factor() {
   auto peeked = lexer.peek();
 //  std::cout << "fact" << std::endl;
 
   if (peeked.type == Token::Type::PLUS || peeked.type == Token::Type::MINUS || peeked.type == Token::Type::NOT) {
-    return std::shared_ptr<AST>(new UnaryOp(lexer.getNextToken(), factor()));
+    auto op = lexer.getNextToken();
+    auto operand = factor();
+    return makeShared<UnaryOp>({ConsKey::UNARY_OP, op.type, 0, operand, nullptr}, op, operand);
   } else if (peeked.type == Token::Type::INTEGER_CONST) {
     return number();
   } else if (peeked.type == Token::Type::LEFT_PAREN) {
@@ -61,139 +254,313 @@ std::shared_ptr<AST> Parser::factor() {
     }
     return variable();
   } else {
-    std::cout << (peeked.type == Token::Type::END_OF_FILE) << std::endl;
-    lexer.print();
-    throw std::invalid_argument("Invalid Factor.");
+    fail(DiagnosticCode::EXPECTED_EXPRESSION, peeked);
+    return empty();
   }
 }
 
-// multDivFactor: factor ((MULTIPLY | DIVIDE) factor)*
-std::shared_ptr<AST> Parser::multDivFactor() {
-  auto node = factor();
-  auto peeked = lexer.peek();
-  while (peeked.type == Token::Type::MULTPLY || peeked.type == Token::Type::DIVIDE) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, factor()));
-    peeked = lexer.peek();
+// How tightly each binary operator binds, indexed by token type; zero for
+// tokens that end an expression. Every level is left associative.
+//   comparison: EQUAL NOT_EQUAL
+//   or:         OR
+//   and:        AND
+//   relational: LESS LESS_EQUAL GREATER GREATER_EQUAL
+//   addSub:     PLUS MINUS
+//   multDiv:    MULTIPLY DIVIDE
+struct BindingPowers {
+  unsigned char of[Token::Type::END_OF_FILE + 1] = {};
+
+  constexpr BindingPowers() {
+    of[Token::Type::EQUAL] = of[Token::Type::NOT_EQUAL] = 1;
+    of[Token::Type::OR] = 2;
+    of[Token::Type::AND] = 3;
+    of[Token::Type::LESS] = of[Token::Type::LESS_EQUAL] = 4;
+    of[Token::Type::GREATER] = of[Token::Type::GREATER_EQUAL] = 4;
+    of[Token::Type::PLUS] = of[Token::Type::MINUS] = 5;
+    of[Token::Type::MULTPLY] = of[Token::Type::DIVIDE] = 6;
   }
-  return node;
-}
+};
 
-// addSubFactor: multDivFactor ((PLUS | MINUS) multDivFactor)*
-std::shared_ptr<AST> Parser::addSubFactor() {
-  auto node = multDivFactor();
-  auto peeked = lexer.peek();
-  while (peeked.type == Token::Type::PLUS || peeked.type == Token::Type::MINUS) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, multDivFactor()));
-    peeked = lexer.peek();
-  }
-  return node;
-}
+static constexpr BindingPowers BINDING_POWERS;
 
-// relationalFactor: addSubFactor ((LESS_EQUAL | GREATER_EQUAL | LESS | GREATER) addSubFactor)*
-std::shared_ptr<AST> Parser::relationalFactor() {
-  auto node = addSubFactor();
-  auto peeked = lexer.peek();
-  while (
-    peeked.type == Token::Type::LESS || peeked.type == Token::Type::LESS_EQUAL ||
-    peeked.type == Token::Type::GREATER || peeked.type == Token::Type::GREATER_EQUAL
-  ) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, addSubFactor()));
-    peeked = lexer.peek();
+// Precedence climbing: parses a factor, then every operator that binds at
+// least minPower, with each right operand taking only tighter operators. Each
+// operand costs one factor() call and one peek() whatever its depth in the
+// precedence levels.
+AST* Parser::binaryExpression(int minPower) {
+  auto node = factor();
+  Token op = lexer.peek();
+  for (int power = BINDING_POWERS.of[op.type]; power != 0 && power >= minPower; power = BINDING_POWERS.of[op.type]) {
+    lexer.getNextToken();
+    auto right = binaryExpression(power + 1);
+    node = makeShared<BinaryOp>({ConsKey::BINARY_OP, op.type, 0, node, right}, node, op, right);
+    op = lexer.peek();
   }
   return node;
 }
 
-// andFactor: relationalFactor (AND relationalFactor)*
-std::shared_ptr<AST> Parser::andFactor() {
-  auto node = relationalFactor();
-  auto peeked = lexer.peek();
-  while (peeked.type == Token::Type::AND) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, relationalFactor()));
-    peeked = lexer.peek();
+// expression: factor (binary operator factor)*, grouped by BINDING_POWERS
+AST* Parser::expression() {
+  if (iterative) {
+    return iterativeExpression();
   }
-  return node;
+  return binaryExpression(1);
 }
 
-// orFactor: andFactor (OR andFactor)*
-std::shared_ptr<AST> Parser::orFactor() {
-  auto node = andFactor();
-  auto peeked = lexer.peek();
-  while (peeked.type == Token::Type::OR) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, andFactor()));
-    peeked = lexer.peek();
+bool Parser::tooDeep(const Token& at) {
+  if (depth < maxDepth) {
+    return false;
   }
-  return node;
+  fail(DiagnosticCode::NESTING_TOO_DEEP, at);
+  return true;
 }
 
-// comparisonFactor: orFactor ((EQUAL | NOT_EQUAL) orFactor)*
-std::shared_ptr<AST> Parser::comparisonFactor() {
-  auto node = orFactor();
-  auto peeked = lexer.peek();
-  while (peeked.type == Token::Type::EQUAL || peeked.type == Token::Type::NOT_EQUAL) {
-    auto op = lexer.getNextToken();
-    node = std::shared_ptr<AST>(new BinaryOp(node, op, orFactor()));
-    peeked = lexer.peek();
+// What iterativeExpression() has open: an operator waiting for its right
+// operand, a parenthesis, or a call collecting its arguments in pending.
+struct ExpressionFrame {
+  enum Kind : uint8_t {UNARY, BINARY, PAREN, CALL} kind;
+  Token op;
+  AST* name;
+  size_t from;
+};
+
+// factor() and binaryExpression() with their recursion turned into a stack of
+// frames and a stack of finished operands. Every token is pushed and popped at
+// most once, and unary operators are applied as soon as their operand is
+// done, exactly where factor() would return.
+AST* Parser::iterativeExpression() {
+  std::vector<ExpressionFrame> frames;
+  std::vector<AST*> operands;
+  while (true) {
+    // Expecting an operand, opening frames until one is found.
+    Token peeked = lexer.peek();
+    if (peeked.type == Token::Type::PLUS || peeked.type == Token::Type::MINUS || peeked.type == Token::Type::NOT ||
+        peeked.type == Token::Type::LEFT_PAREN) {
+      if (tooDeep(peeked)) {
+        operands.push_back(empty());
+      } else {
+        lexer.getNextToken();
+        depth++;
+        frames.push_back({peeked.type == Token::Type::LEFT_PAREN ? ExpressionFrame::PAREN : ExpressionFrame::UNARY, peeked, nullptr, 0});
+        continue;
+      }
+    } else if (peeked.type == Token::Type::ID && lexer.peek(2).type == Token::Type::LEFT_PAREN) {
+      if (tooDeep(peeked)) {
+        operands.push_back(empty());
+      } else {
+        auto name = variable();
+        lexer.getNextToken();
+        depth++;
+        frames.push_back({ExpressionFrame::CALL, peeked, name, pending.size()});
+        if (lexer.peek().type != Token::Type::RIGHT_PAREN) {
+          continue;
+        }
+        frames.pop_back();
+        depth--;
+        auto actualParams = takeList(pending.size());
+        eat(Token::Type::RIGHT_PAREN);
+        operands.push_back(nodes->make<Call>(name, actualParams));
+      }
+    } else if (peeked.type == Token::Type::INTEGER_CONST) {
+      operands.push_back(number());
+    } else if (peeked.type == Token::Type::TRUE || peeked.type == Token::Type::FALSE) {
+      operands.push_back(boolean());
+    } else if (peeked.type == Token::Type::ID) {
+      operands.push_back(variable());
+    } else {
+      fail(DiagnosticCode::EXPECTED_EXPRESSION, peeked);
+      operands.push_back(empty());
+    }
+
+    // Expecting an operator, closing frames until one is found.
+    while (true) {
+      while (!frames.empty() && frames.back().kind == ExpressionFrame::UNARY) {
+        const Token& op = frames.back().op;
+        operands.back() = makeShared<UnaryOp>({ConsKey::UNARY_OP, op.type, 0, operands.back(), nullptr}, op, operands.back());
+        frames.pop_back();
+        depth--;
+      }
+      Token op = lexer.peek();
+      int power = BINDING_POWERS.of[op.type];
+      // Operators that bind at least as tightly as op take their right operand now.
+      while (!frames.empty() && frames.back().kind == ExpressionFrame::BINARY &&
+             (power == 0 || BINDING_POWERS.of[frames.back().op.type] >= power)) {
+        AST* right = operands.back();
+        operands.pop_back();
+        const Token& applied = frames.back().op;
+        operands.back() = makeShared<BinaryOp>({ConsKey::BINARY_OP, applied.type, 0, operands.back(), right}, operands.back(), applied, right);
+        frames.pop_back();
+      }
+      if (power != 0) {
+        lexer.getNextToken();
+        frames.push_back({ExpressionFrame::BINARY, op, nullptr, 0});
+        break;
+      }
+      if (frames.empty()) {
+        return operands.back();
+      }
+      ExpressionFrame& open = frames.back();
+      if (open.kind == ExpressionFrame::PAREN) {
+        eat(Token::Type::RIGHT_PAREN);
+      } else {
+        pending.push_back(operands.back());
+        operands.pop_back();
+        if (op.type == Token::Type::COMMA) {
+          lexer.getNextToken();
+          break;
+        }
+        auto actualParams = takeList(open.from);
+        eat(Token::Type::RIGHT_PAREN);
+        operands.push_back(nodes->make<Call>(open.name, actualParams));
+      }
+      frames.pop_back();
+      depth--;
+    }
   }
-  return node;
 }
 
-// expression: comparisonFactor
-std::shared_ptr<AST> Parser::expression() {
-  return comparisonFactor();
+// program: PROGRAM variable SEMI block DOT
+AST* Parser::program() {
+  size_t start = lexer.replaying() ? lexer.mark() : 0;
+  size_t reported = lexer.diagnosticsSink() != nullptr ? lexer.diagnosticsSink()->size() : 0;
+  AST* varNode;
+  AST* blockNode;
+  bool bodiesParsed;
+  try {
+    eat(Token::Type::PROGRAM);
+    varNode = variable();
+    eat(Token::Type::SEMI);
+    blockNode = block();
+    eat(Token::Type::DOT);
+    bodiesParsed = unparsed.empty() || parseUnparsedBodies();
+  } catch (const std::invalid_argument&) {
+    // Without diagnostics the first error throws, and a skipped body may have an earlier one.
+    if (!parallelFunctions || !lexer.replaying()) {
+      throw;
+    }
+    bodiesParsed = false;
+  }
+  if (!bodiesParsed) {
+    rewind(start, reported);
+    parallelFunctions = false;
+    AST* programNode = program();
+    parallelFunctions = true;
+    return programNode;
+  }
+  if (!lazyFunctions) {
+    consed.reset();
+  }
+  return nodes->make<Program>(varNode, blockNode);
 }
 
-// program: PROGRAM variable SEMI block DOT
-std::shared_ptr<AST> Parser::program() {
+AST* Parser::streamProgram(const std::function<void(AST*)>& declared, const std::function<void(AST*)>& parsed) {
   eat(Token::Type::PROGRAM);
   auto varNode = variable();
   eat(Token::Type::SEMI);
-  auto blockNode = block();
+  // Lazy bodies would be parsed on the thread running the program, while this
+  // parser is still busy with the main block.
+  bool lazy = lazyFunctions;
+  lazyFunctions = false;
+  size_t start = lexer.replaying() ? lexer.mark() : 0;
+  size_t reported = lexer.diagnosticsSink() != nullptr ? lexer.diagnosticsSink()->size() : 0;
+  NodeList decls;
+  bool bodiesParsed;
+  try {
+    decls = declarations();
+    bodiesParsed = unparsed.empty() || parseUnparsedBodies();
+  } catch (const std::invalid_argument&) {
+    if (!parallelFunctions || !lexer.replaying()) {
+      throw;
+    }
+    bodiesParsed = false;
+  }
+  if (!bodiesParsed) {
+    rewind(start, reported);
+    parallelFunctions = false;
+    decls = declarations();
+    parallelFunctions = true;
+  }
+  lazyFunctions = lazy;
+  auto blockNode = nodes->make<Block>(decls, nullptr);
+  auto programNode = nodes->make<Program>(varNode, blockNode);
+  auto clean = [this]() {
+    return lexer.diagnosticsSink() == nullptr || lexer.diagnosticsSink()->empty();
+  };
+  if (clean()) {
+    declared(programNode);
+  }
+  eat(Token::Type::BEGIN);
+  auto children = statementList([&](AST* statement) {
+    if (clean()) {
+      parsed(statement);
+    }
+  });
+  eat(Token::Type::END);
+  blockNode->compoundStatement = nodes->make<Compound>(children);
   eat(Token::Type::DOT);
-  return std::shared_ptr<AST>(new Program(varNode, blockNode));
+  consed.reset();
+  return programNode;
 }
 
 // compoundStatement: BEGIN statementList END
-std::shared_ptr<AST> Parser::compoundStatement() {
+AST* Parser::compoundStatement() {
+  if (iterative) {
+    return iterativeCompound();
+  }
   eat(Token::Type::BEGIN);
-  auto nodes = statementList();
+  auto children = statementList();
   eat(Token::Type::END);
-  auto root = std::make_shared<Compound>();
-  for (const auto& node : nodes) {
-    root->children.push_back(node);
-  }
-  return root;
+  return nodes->make<Compound>(children);
 }
 
 // block: declarations compoundStatement
-std::shared_ptr<AST> Parser::block() {
-  std::vector<std::shared_ptr<AST>> decls = declarations();
+AST* Parser::block() {
+  NodeList decls = declarations();
   // TODO: decls
-  std::shared_ptr<AST> compoundStatementNode = compoundStatement();
-  return std::shared_ptr<AST>(new Block(decls, compoundStatementNode));
+  AST* compoundStatementNode = compoundStatement();
+  return nodes->make<Block>(decls, compoundStatementNode);
 }
 
 // statementList : statement (statement)*
-std::vector<std::shared_ptr<AST>> Parser::statementList() {
-  std::vector<std::shared_ptr<AST>> nodes;
-  nodes.push_back(statement());
-  while (lexer.peek().type == Token::Type::SEMI) {
-    lexer.getNextToken();
-    nodes.push_back(statement());
-  }
-  if (lexer.peek().type == Token::Type::ID) {
-    std::cout << lexer.peek().name << std::endl;
-    throw std::invalid_argument("AHH");
+NodeList Parser::statementList() {
+  return statementList(nullptr);
+}
+
+// Hands each statement to parsed, when set, as soon as it is complete.
+NodeList Parser::statementList(const std::function<void(AST*)>& parsed) {
+  size_t from = pending.size();
+  auto add = [&]() {
+    pending.push_back(statement());
+    if (parsed) {
+      parsed(pending.back());
+    }
+  };
+  add();
+  while (true) {
+    if (panicking) {
+      synchronize();
+    }
+    Token next = lexer.peek();
+    if (next.type == Token::Type::END || next.type == Token::Type::DOT || next.type == Token::Type::END_OF_FILE) {
+      break;
+    }
+    if (next.type == Token::Type::SEMI) {
+      lexer.getNextToken();
+    } else if (next.type == Token::Type::ID || next.type == Token::Type::BEGIN) {
+      // A forgotten semicolon: report it, but parse the statement that follows.
+      fail(DiagnosticCode::UNEXPECTED_TOKEN, next, Token::Type::SEMI);
+      panicking = false;
+    } else {
+      fail(DiagnosticCode::UNEXPECTED_TOKEN, next, Token::Type::SEMI);
+      continue;
+    }
+    add();
   }
-  return nodes;
+  return takeList(from);
 }
 
 // statement: compoundStatement | ifStatement | whileStatement | callStatement | assignmentStatement | empty
-std::shared_ptr<AST> Parser::statement() {
+AST* Parser::statement() {
   auto type = lexer.peek().type;
   if (type == Token::Type::BEGIN) {
     return compoundStatement();
@@ -206,124 +573,348 @@ std::shared_ptr<AST> Parser::statement() {
   return empty();
 }
 
-std::shared_ptr<AST> Parser::empty() {
-  return std::shared_ptr<AST>(new NoOp);
+// compoundStatement() and statementList() with a stack of the open BEGINs,
+// each remembered by where its statements start in pending. Recovers from
+// errors exactly as statementList() does.
+AST* Parser::iterativeCompound() {
+  std::vector<size_t> open;
+  eat(Token::Type::BEGIN);
+  open.push_back(pending.size());
+  depth++;
+  while (true) {
+    Token next = lexer.peek();
+    if (next.type == Token::Type::BEGIN && !tooDeep(next)) {
+      lexer.getNextToken();
+      open.push_back(pending.size());
+      depth++;
+      continue;
+    }
+    if (next.type == Token::Type::BEGIN) {
+      // Too deep: synchronize() skips the whole block.
+      pending.push_back(empty());
+    } else {
+      pending.push_back(statement());
+    }
+
+    while (true) {
+      if (panicking) {
+        synchronize();
+      }
+      next = lexer.peek();
+      if (next.type == Token::Type::END || next.type == Token::Type::DOT || next.type == Token::Type::END_OF_FILE) {
+        auto children = takeList(open.back());
+        eat(Token::Type::END);
+        open.pop_back();
+        depth--;
+        AST* compound = nodes->make<Compound>(children);
+        if (open.empty()) {
+          return compound;
+        }
+        pending.push_back(compound);
+        continue;
+      }
+      if (next.type == Token::Type::SEMI) {
+        lexer.getNextToken();
+      } else if (next.type == Token::Type::ID || next.type == Token::Type::BEGIN) {
+        fail(DiagnosticCode::UNEXPECTED_TOKEN, next, Token::Type::SEMI);
+        panicking = false;
+      } else {
+        fail(DiagnosticCode::UNEXPECTED_TOKEN, next, Token::Type::SEMI);
+        continue;
+      }
+      break;
+    }
+  }
+}
+
+AST* Parser::empty() {
+  return nodes->make<NoOp>();
 }
 
 // assignmentStatement: variable ASSIGN expr
-std::shared_ptr<AST> Parser::assignmentStatement() {
+AST* Parser::assignmentStatement() {
   auto var = variable();
   eat(Token::Type::ASSIGN);
   auto expr = expression();
-  return std::shared_ptr<AST>(new Assign(var, expr));
+  return nodes->make<Assign>(var, expr);
 }
 
 // callStatement: ID LEFT_PAREN (expr (COMMA expr)*)? RIGHT_PAREN
-std::shared_ptr<AST> Parser::callStatement() {
+AST* Parser::callStatement() {
   auto name = variable();
   eat(Token::Type::LEFT_PAREN);
-  std::vector<std::shared_ptr<AST>> actualParams;
+  size_t from = pending.size();
   if (lexer.peek().type != Token::Type::RIGHT_PAREN) {
-    actualParams.push_back(expression());
+    pending.push_back(expression());
     while (lexer.peek().type == Token::Type::COMMA) {
       lexer.getNextToken();
-      actualParams.push_back(expression());
+      pending.push_back(expression());
     }
   }
+  auto actualParams = takeList(from);
   eat(Token::Type::RIGHT_PAREN);
-  return std::shared_ptr<AST>(new Call(name, actualParams));
+  return nodes->make<Call>(name, actualParams);
 }
 
 // declarations: (VAR (variableDeclaration SEMI)+)* (PROCEDURE ID (LEFT_PAREN formalParameterList RIGHT_PAREN)? SEMI block SEMI)* (FUNCTION ID (LEFT_PAREN formalParameterList RIGHT_PAREN)? SEMI block SEMI)* | empty
-std::vector<std::shared_ptr<AST>> Parser::declarations() {
-  std::vector<std::shared_ptr<AST>> declarationsNodes;
+NodeList Parser::declarations() {
+  size_t from = pending.size();
 
   if (lexer.peek().type == Token::Type::VAR) {
     lexer.getNextToken();
     while (lexer.peek().type == Token::Type::ID) {
-      auto varDecs = variableDeclaration();
-      // append varDecs to declarationNodes
-      declarationsNodes.insert(declarationsNodes.end(), varDecs.begin(), varDecs.end());
+      variableDeclaration();
+      if (panicking) {
+        synchronize();
+      }
       eat(Token::Type::SEMI);
     }
   }
 
   while(lexer.peek().type == Token::Type::FUNCTION) {
+    // Only the program's own FUNCTIONs are offered for reuse.
+    bool offered = reuse != nullptr && depth == 0 && !panicking;
+    size_t first = offered ? lexer.mark() : 0;
+    size_t end;
+    if (offered) {
+      if (FunctionDecl* reused = reuse->reusable(first, end)) {
+        lexer.resume(end);
+        pending.push_back(reused);
+        eat(Token::Type::SEMI);
+        continue;
+      }
+    }
     lexer.getNextToken();
     auto name = variable();
-    std::vector<std::shared_ptr<AST>> args;
+    NodeList args;
     if (lexer.peek().type == Token::Type::LEFT_PAREN) {
       lexer.getNextToken();
       args = formalParameterList();
       eat(Token::Type::RIGHT_PAREN);
     }
     eat(Token::Type::SEMI);
-    auto blockNode = block();
-    declarationsNodes.push_back(std::shared_ptr<AST>(new FunctionDecl(name, args, blockNode)));
+    if (lazyFunctions && lexer.canResume()) {
+      auto deferred = nodes->make<DeferredBlock>(DeferredBlock{this, lexer.mark(), 0, depth, nullptr});
+      skipBlock();
+      deferred->end = lexer.mark();
+      pending.push_back(nodes->make<FunctionDecl>(name, args, nullptr, deferred));
+    } else if (parallelFunctions && lexer.replaying() && !panicking) {
+      // Only the program's own FUNCTIONs get here; nested ones are inside skipped
+      // bodies. A body after an unrecovered error is parsed here, since the
+      // error decides what gets reported in it.
+      auto deferred = nodes->make<DeferredBlock>(DeferredBlock{this, lexer.mark(), 0, depth, nullptr});
+      skipBlock();
+      deferred->end = lexer.mark();
+      unparsed.push_back(nodes->make<FunctionDecl>(name, args, nullptr, deferred));
+      pending.push_back(unparsed.back());
+    } else if (iterative && tooDeep(lexer.peek())) {
+      skipBlock();
+      // The whole body is skipped, so the error does not spill past it.
+      panicking = false;
+      pending.push_back(nodes->make<FunctionDecl>(name, args, empty()));
+    } else {
+      depth++;
+      auto blockNode = block();
+      depth--;
+      pending.push_back(nodes->make<FunctionDecl>(name, args, blockNode));
+      if (offered) {
+        reuse->parsed(first, lexer.mark(), static_cast<FunctionDecl*>(pending.back()));
+      }
+    }
     eat(Token::Type::SEMI);
   }
 
-  return declarationsNodes;
+  return takeList(from);
+}
+
+// Skips a FUNCTION's block without building it. Every nested FUNCTION adds a
+// block to skip, and each block ends with the END that closes its outermost
+// BEGIN.
+void Parser::skipBlock() {
+  int blocks = 1;
+  int depth = 0;
+  while (true) {
+    Token token = lexer.peek();
+    if (token.type == Token::Type::END_OF_FILE) {
+      fail(DiagnosticCode::UNEXPECTED_TOKEN, token, Token::Type::END);
+      return;
+    }
+    lexer.getNextToken();
+    if (token.type == Token::Type::FUNCTION) {
+      blocks++;
+    } else if (token.type == Token::Type::BEGIN) {
+      depth++;
+    } else if (token.type == Token::Type::END && --depth == 0 && --blocks == 0) {
+      return;
+    }
+  }
+}
+
+// Parses a skipped body as declarations() would have, inside the same number
+// of open FUNCTIONs and blocks, so the depth limit applies to it the same way.
+AST* Parser::deferredBlock(size_t mark, size_t outerDepth) {
+  lexer.resume(mark);
+  size_t saved = depth;
+  depth = outerDepth;
+  AST* blockNode;
+  if (iterative && tooDeep(lexer.peek())) {
+    skipBlock();
+    panicking = false;
+    blockNode = empty();
+  } else {
+    depth++;
+    blockNode = block();
+  }
+  depth = saved;
+  return blockNode;
+}
+
+// Bodies are split into contiguous batches, a few per thread, and every batch
+// gets a parser and arena of its own over the shared tokens. The main arena
+// adopts the batch arenas, and each batch's diagnostics are merged back, so the
+// result is the tree and errors a serial parse would give. That only holds for
+// bodies without errors that end where skipBlock() ended them, so a batch that
+// finds anything else reports failure, and the caller parses serially instead.
+// With hash consing the batches share this parser's table, so they share nodes
+// with each other and with the rest of the program.
+bool Parser::parseUnparsedBodies() {
+  ThreadPool pool(parallelThreads);
+  size_t batches = std::min<size_t>(unparsed.size(), pool.size() * 4);
+  std::vector<std::unique_ptr<Parser>> workers;
+  std::vector<std::future<void>> done;
+  std::unique_ptr<bool[]> clean(new bool[batches]);
+  if (hashConsing) {
+    if (consed == nullptr) {
+      consed = std::make_shared<ConsTable>();
+    }
+    consed->shared = true;
+  }
+  for (size_t b = 0; b < batches; ++b) {
+    size_t from = b * unparsed.size() / batches;
+    size_t to = (b + 1) * unparsed.size() / batches;
+    workers.emplace_back(new Parser(lexer.replay(), interner()));
+    Parser* worker = workers.back().get();
+    if (lexer.diagnosticsSink() != nullptr) {
+      worker->setDiagnostics(std::make_shared<Diagnostics>());
+    }
+    worker->setIterative(iterative, maxDepth);
+    worker->setHashConsing(hashConsing);
+    worker->consed = consed;
+    FunctionDecl* const* batch = unparsed.data();
+    bool* batchClean = &clean[b];
+    done.push_back(pool.submit([worker, batch, from, to, batchClean]() {
+      *batchClean = false;
+      for (size_t i = from; i < to; ++i) {
+        DeferredBlock& deferred = *batch[i]->deferred;
+        try {
+          batch[i]->block = deferred.block = worker->deferredBlock(deferred.mark, deferred.depth);
+        } catch (const std::invalid_argument&) {
+          return;
+        }
+        if (worker->lexer.mark() != deferred.end) {
+          return;
+        }
+      }
+      auto diagnostics = worker->lexer.diagnosticsSink();
+      *batchClean = diagnostics == nullptr || diagnostics->empty();
+    }));
+  }
+  // Every batch has to finish before its parser goes away, even when one throws.
+  for (auto& batch : done) {
+    batch.wait();
+  }
+  if (consed != nullptr) {
+    consed->shared = false;
+  }
+  unparsed.clear();
+  // The nodes stay even when the bodies are parsed again: a shared hash consing
+  // table may point at them.
+  for (auto& worker : workers) {
+    nodes->adopt(worker->nodes);
+  }
+  for (auto& batch : done) {
+    batch.get();
+  }
+  if (!std::all_of(clean.get(), clean.get() + batches, [](bool batchClean) { return batchClean; })) {
+    return false;
+  }
+  if (lexer.diagnosticsSink() != nullptr) {
+    for (auto& worker : workers) {
+      lexer.diagnosticsSink()->merge(*worker->lexer.diagnosticsSink());
+    }
+  }
+  return true;
+}
+
+// Goes back to mark to parse again from there, keeping only the first reported
+// diagnostics.
+void Parser::rewind(size_t mark, size_t reported) {
+  unparsed.clear();
+  pending.clear();
+  depth = 0;
+  lexer.resume(mark);
+  if (lexer.diagnosticsSink() != nullptr) {
+    lexer.diagnosticsSink()->truncate(reported);
+  }
+  panicking = false;
 }
 
 // variableDeclaration: ID (COMMA ID)* COLON typeSpec
-std::vector<std::shared_ptr<AST>> Parser::variableDeclaration() {
-  std::vector<std::shared_ptr<AST>> varNodes;
-  varNodes.push_back(this->variable());
+void Parser::variableDeclaration() {
+  size_t from = pending.size();
+  pending.push_back(this->variable());
 
   while (lexer.peek().type == Token::Type::COMMA) {
     lexer.getNextToken();
-    varNodes.push_back(this->variable());
+    pending.push_back(this->variable());
   }
   eat(Token::Type::COLON);
   auto type = typeSpec();
 
-  std::vector<std::shared_ptr<AST>> withTypes;
-  withTypes.reserve(varNodes.size());
-  for(const auto& varNode : varNodes) {
-    withTypes.push_back(std::shared_ptr<AST>(new VarDecl(varNode, type)));
+  for (size_t i = from; i < pending.size(); ++i) {
+    pending[i] = nodes->make<VarDecl>(pending[i], type);
   }
-  return withTypes;
 }
 
 // typeSpec: INTEGER | REAL | BOOLEAN
-std::shared_ptr<AST> Parser::typeSpec() {
-  auto type = lexer.getNextToken().type;
-  if (type == Token::Type::INTEGER) {
-    return std::shared_ptr<AST>(new Type("INTEGER"));
-  } else if (type == Token::Type::BOOLEAN) {
-    return std::shared_ptr<AST>(new Type("BOOLEAN"));
+AST* Parser::typeSpec() {
+  Token token = lexer.peek();
+  if (token.type == Token::Type::INTEGER) {
+    lexer.getNextToken();
+    return makeShared<Type>({ConsKey::TYPE, token.type, 0, nullptr, nullptr}, "INTEGER");
+  } else if (token.type == Token::Type::BOOLEAN) {
+    lexer.getNextToken();
+    return makeShared<Type>({ConsKey::TYPE, token.type, 0, nullptr, nullptr}, "BOOLEAN");
   } else {
-    throw std::invalid_argument("ERROR");
+    fail(DiagnosticCode::EXPECTED_TYPE, token);
+    return makeShared<Type>({ConsKey::TYPE, Token::Type::END_OF_FILE, 0, nullptr, nullptr}, "");
   }
 }
 
 // formalParameterList: formalParameter (SEMI formalParameter)*
-std::vector<std::shared_ptr<AST>> Parser::formalParameterList() {
-  std::vector<std::shared_ptr<AST>> params = formalParameter();
+NodeList Parser::formalParameterList() {
+  size_t from = pending.size();
+  formalParameter();
 
   while (lexer.peek().type == Token::Type::SEMI) {
-    std::vector<std::shared_ptr<AST>> newParams = formalParameter();
-    params.insert(params.end(), newParams.begin(), newParams.end());
+    lexer.getNextToken();
+    formalParameter();
   }
-  return params;
+  return takeList(from);
 }
 
 // formalParameter: ID (COMMA ID)* COLON typeSpec
-std::vector<std::shared_ptr<AST>> Parser::formalParameter() {
-  std::vector<std::shared_ptr<AST>> vars;
-  vars.push_back(variable());
+void Parser::formalParameter() {
+  size_t from = pending.size();
+  pending.push_back(variable());
   while (lexer.peek().type == Token::Type::COMMA) {
-    vars.push_back(variable());
+    lexer.getNextToken();
+    pending.push_back(variable());
   }
   eat(Token::Type::COLON);
   auto type = typeSpec();
 
-  std::vector<std::shared_ptr<AST>> params;
-  params.reserve(vars.size());
-  for (const auto& var : vars) {
-    params.push_back(std::shared_ptr<AST>(new Param(var, type)));
+  for (size_t i = from; i < pending.size(); ++i) {
+    pending[i] = nodes->make<Param>(pending[i], type);
   }
-
-  return params;
-}
\ No newline at end of file
+}
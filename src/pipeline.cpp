@@ -0,0 +1,89 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "interpreter.h"
+
+// Carries statements from the parser thread to the thread running them. The
+// parser blocks while capacity statements are waiting; a null statement marks
+// the end of the program.
+class StatementQueue {
+private:
+  std::deque<AST*> statements;
+  std::mutex mutex;
+  std::condition_variable notFull;
+  std::condition_variable notEmpty;
+  size_t capacity;
+  bool closed = false;
+public:
+  explicit StatementQueue(size_t capacity): capacity(capacity < 1 ? 1 : capacity) {}
+
+  // Drops the statement once the runner has stopped taking them.
+  void push(AST* statement) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this]() { return closed || statements.size() < capacity; });
+    if (closed) {
+      return;
+    }
+    statements.push_back(statement);
+    notEmpty.notify_one();
+  }
+
+  AST* pop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this]() { return !statements.empty(); });
+    AST* statement = statements.front();
+    statements.pop_front();
+    notFull.notify_one();
+    return statement;
+  }
+
+  // Called by the runner when it stops early, so the parser never blocks.
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    notFull.notify_all();
+  }
+};
+
+// The parser thread only allocates new nodes while the runner reads finished
+// ones, and lazy bodies are parsed up front, so the two never share mutable
+// state beyond the queue.
+AST* runPipelined(Parser& parser, PrintVisitor& printer, size_t capacity) {
+  StatementQueue queue(capacity);
+  AST* program = nullptr;
+  std::exception_ptr parseError;
+  std::thread parsing([&]() {
+    try {
+      program = parser.streamProgram([&](AST* declared) { queue.push(declared); }, [&](AST* statement) { queue.push(statement); });
+    } catch (...) {
+      parseError = std::current_exception();
+    }
+    queue.push(nullptr);
+  });
+
+  try {
+    // Runs what visit(Program) would, one piece at a time.
+    if (AST* declared = queue.pop()) {
+      auto& header = dynamic_cast<Program&>(*declared);
+      header.name->accept(printer);
+      printer.callstack = std::make_shared<ActivationRecord>(printer.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+      for (auto declaration : dynamic_cast<Block&>(*header.block).declarations) {
+        declaration->accept(printer);
+      }
+      while (AST* statement = queue.pop()) {
+        statement->accept(printer);
+      }
+    }
+  } catch (...) {
+    queue.close();
+    parsing.join();
+    throw;
+  }
+  parsing.join();
+  if (parseError) {
+    std::rethrow_exception(parseError);
+  }
+  return program;
+}
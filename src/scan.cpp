@@ -0,0 +1,194 @@
+#include "scan.h"
+#include "interpreter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Scalar
+
+static const char* scalarWhitespace(const char* begin, const char* end) {
+  while (begin < end && charClass(*begin) == CHAR_SPACE) {
+    ++begin;
+  }
+  return begin;
+}
+
+static const char* scalarCommentEnd(const char* begin, const char* end) {
+  while (begin < end && *begin != '}') {
+    ++begin;
+  }
+  return begin;
+}
+
+static const char* scalarIdentifier(const char* begin, const char* end) {
+  while (begin < end && isAlnum(*begin)) {
+    ++begin;
+  }
+  return begin;
+}
+
+static const ScanKernels SCALAR_KERNELS = {
+    ScanKernels::Level::SCALAR, scalarWhitespace, scalarCommentEnd, scalarIdentifier
+};
+
+#ifdef SCAN_X86
+
+// Every kernel builds a mask of the bytes that belong to the run and stops at
+// the first zero bit. Ranges are tested with one subtract and one saturating
+// subtract: (c - low) -sat (high - low) is zero exactly when low <= c <= high.
+
+#if defined(__SSE2__)
+
+static inline __m128i sse2InRange(__m128i chars, char low, char high) {
+  __m128i shifted = _mm_sub_epi8(chars, _mm_set1_epi8(low));
+  __m128i over = _mm_subs_epu8(shifted, _mm_set1_epi8(static_cast<char>(high - low)));
+  return _mm_cmpeq_epi8(over, _mm_setzero_si128());
+}
+
+static inline unsigned sse2WhitespaceMask(__m128i chars) {
+  __m128i space = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+  __m128i control = sse2InRange(chars, '\t', '\r');
+  return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(space, control)));
+}
+
+static inline unsigned sse2IdentifierMask(__m128i chars) {
+  __m128i digit = sse2InRange(chars, '0', '9');
+  __m128i letter = sse2InRange(_mm_or_si128(chars, _mm_set1_epi8(0x20)), 'a', 'z');
+  return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(digit, letter)));
+}
+
+static const char* sse2Whitespace(const char* begin, const char* end) {
+  while (end - begin >= 16) {
+    unsigned mask = sse2WhitespaceMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin))) ^ 0xFFFFu;
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+  return scalarWhitespace(begin, end);
+}
+
+static const char* sse2CommentEnd(const char* begin, const char* end) {
+  const __m128i close = _mm_set1_epi8('}');
+  while (end - begin >= 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, close)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+  return scalarCommentEnd(begin, end);
+}
+
+static const char* sse2Identifier(const char* begin, const char* end) {
+  while (end - begin >= 16) {
+    unsigned mask = sse2IdentifierMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(begin))) ^ 0xFFFFu;
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+  return scalarIdentifier(begin, end);
+}
+
+static const ScanKernels SSE2_KERNELS = {
+    ScanKernels::Level::SSE2, sse2Whitespace, sse2CommentEnd, sse2Identifier
+};
+
+#define SCAN_HAS_SSE2 1
+#endif
+
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 static inline __m256i avx2InRange(__m256i chars, char low, char high) {
+  __m256i shifted = _mm256_sub_epi8(chars, _mm256_set1_epi8(low));
+  __m256i over = _mm256_subs_epu8(shifted, _mm256_set1_epi8(static_cast<char>(high - low)));
+  return _mm256_cmpeq_epi8(over, _mm256_setzero_si256());
+}
+
+SCAN_AVX2 static const char* avx2Whitespace(const char* begin, const char* end) {
+  while (end - begin >= 32) {
+    __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')), avx2InRange(chars, '\t', '\r'));
+    unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(space));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return scalarWhitespace(begin, end);
+}
+
+SCAN_AVX2 static const char* avx2CommentEnd(const char* begin, const char* end) {
+  const __m256i close = _mm256_set1_epi8('}');
+  while (end - begin >= 32) {
+    __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, close)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return scalarCommentEnd(begin, end);
+}
+
+SCAN_AVX2 static const char* avx2Identifier(const char* begin, const char* end) {
+  while (end - begin >= 32) {
+    __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i digit = avx2InRange(chars, '0', '9');
+    __m256i letter = avx2InRange(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), 'a', 'z');
+    unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(digit, letter)));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return scalarIdentifier(begin, end);
+}
+
+static const ScanKernels AVX2_KERNELS = {
+    ScanKernels::Level::AVX2, avx2Whitespace, avx2CommentEnd, avx2Identifier
+};
+
+#endif
+
+const ScanKernels* scanKernels(ScanKernels::Level level) {
+  switch (level) {
+    case ScanKernels::Level::SCALAR:
+      return &SCALAR_KERNELS;
+    case ScanKernels::Level::SSE2:
+#ifdef SCAN_HAS_SSE2
+      return &SSE2_KERNELS;
+#else
+      return nullptr;
+#endif
+    case ScanKernels::Level::AVX2:
+#ifdef SCAN_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+        return &AVX2_KERNELS;
+      }
+#endif
+      return nullptr;
+  }
+  return nullptr;
+}
+
+static const ScanKernels& pickScanKernels() {
+  const ScanKernels::Level levels[] = {ScanKernels::Level::AVX2, ScanKernels::Level::SSE2};
+  for (auto level : levels) {
+    const ScanKernels* kernels = scanKernels(level);
+    if (kernels != nullptr) {
+      return *kernels;
+    }
+  }
+  return SCALAR_KERNELS;
+}
+
+const ScanKernels& activeScanKernels() {
+  static const ScanKernels& kernels = pickScanKernels();
+  return kernels;
+}
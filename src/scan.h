@@ -0,0 +1,32 @@
+//
+// Bulk character scanning used by the lexer.
+//
+
+#ifndef PROGRAM_SCAN_H
+#define PROGRAM_SCAN_H
+
+// Each kernel scans [begin, end) and returns a pointer to the first character
+// that ends the run, or end if the run reaches the end of the range.
+struct ScanKernels {
+  enum Level {
+    SCALAR,
+    SSE2,
+    AVX2
+  };
+
+  Level level;
+  // First character that is not whitespace.
+  const char* (*whitespace)(const char* begin, const char* end);
+  // First closing '}' of a comment.
+  const char* (*commentEnd)(const char* begin, const char* end);
+  // First character that can not continue an identifier.
+  const char* (*identifier)(const char* begin, const char* end);
+};
+
+// Kernels for a specific instruction set, or nullptr if this CPU or build does not support it.
+const ScanKernels* scanKernels(ScanKernels::Level level);
+
+// The widest kernels the running CPU supports, picked once on first use.
+const ScanKernels& activeScanKernels();
+
+#endif //PROGRAM_SCAN_H
@@ -0,0 +1,143 @@
+#include <utility>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include "interpreter.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#define SOURCE_BUFFER_MMAP 1
+#else
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+SourceBuffer::~SourceBuffer() {
+#ifdef SOURCE_BUFFER_MMAP
+  if (mapping != nullptr) {
+    munmap(mapping, mappedLength);
+  }
+#endif
+}
+
+std::shared_ptr<SourceBuffer> SourceBuffer::fromFile(const std::string& filename) {
+  auto buffer = std::shared_ptr<SourceBuffer>(new SourceBuffer);
+
+#ifdef SOURCE_BUFFER_MMAP
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::invalid_argument("Can not open source file.");
+  }
+  struct stat info {};
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    auto size = static_cast<size_t>(info.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      madvise(mapped, size, MADV_SEQUENTIAL);
+      close(fd);
+      buffer->mapping = mapped;
+      buffer->mappedLength = size;
+      buffer->data = static_cast<const char*>(mapped);
+      buffer->length = size;
+      return buffer;
+    }
+  }
+  // Pipes, character devices and empty files can not be mapped, read them once instead.
+  char chunk[1 << 16];
+  ssize_t count;
+  while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+    buffer->owned.append(chunk, static_cast<size_t>(count));
+  }
+  close(fd);
+  if (count < 0) {
+    throw std::invalid_argument("Can not read source file.");
+  }
+#else
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) {
+    throw std::invalid_argument("Can not open source file.");
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  buffer->owned = contents.str();
+#endif
+
+  buffer->data = buffer->owned.data();
+  buffer->length = buffer->owned.size();
+  return buffer;
+}
+
+std::shared_ptr<SourceBuffer> SourceBuffer::fromString(std::string text) {
+  auto buffer = std::shared_ptr<SourceBuffer>(new SourceBuffer);
+  buffer->owned = std::move(text);
+  buffer->data = buffer->owned.data();
+  buffer->length = buffer->owned.size();
+  return buffer;
+}
+
+std::shared_ptr<SourceBuffer> SourceBuffer::fromView(const char* data, size_t size) {
+  auto buffer = std::shared_ptr<SourceBuffer>(new SourceBuffer);
+  buffer->data = data;
+  buffer->length = size;
+  return buffer;
+}
+
+std::shared_ptr<SourceBuffer> SourceBuffer::fromLines(const std::vector<std::string>& lines) {
+  size_t total = 0;
+  for (const auto& line : lines) {
+    total += line.size() + 1;
+  }
+  std::string text;
+  text.reserve(total);
+  for (const auto& line : lines) {
+    text += line;
+    text += '\n';
+  }
+  return fromString(std::move(text));
+}
+
+SourceStream::~SourceStream() {
+#ifdef SOURCE_BUFFER_MMAP
+  if (ownsFd) {
+    close(fd);
+  }
+#else
+  if (ownsFd) {
+    _close(fd);
+  }
+#endif
+}
+
+std::shared_ptr<SourceStream> SourceStream::fromFile(const std::string& filename) {
+#ifdef SOURCE_BUFFER_MMAP
+  int fd = open(filename.c_str(), O_RDONLY);
+#else
+  int fd = _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#endif
+  if (fd < 0) {
+    throw std::invalid_argument("Can not open source file.");
+  }
+  return std::make_shared<SourceStream>(fd, true);
+}
+
+size_t SourceStream::read(char* into, size_t capacity) {
+  while (true) {
+#ifdef SOURCE_BUFFER_MMAP
+    ssize_t count = ::read(fd, into, capacity);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+#else
+    int count = _read(fd, into, static_cast<unsigned>(capacity));
+#endif
+    if (count < 0) {
+      throw std::invalid_argument("Can not read source stream.");
+    }
+    return static_cast<size_t>(count);
+  }
+}
@@ -1,4 +1,5 @@
 #include "stack.h"
+#include <stdexcept>
 
 template <typename T>
 T Stack<T>::peek() {
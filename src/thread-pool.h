@@ -0,0 +1,50 @@
+//
+// Fixed-size pool of worker threads.
+//
+
+#ifndef PROGRAM_THREAD_POOL_H
+#define PROGRAM_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool stopping = false;
+
+  void work();
+public:
+  // Zero picks one thread per hardware core.
+  explicit ThreadPool(unsigned threads = 0);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  // Finishes every queued task before joining the workers.
+  ~ThreadPool();
+
+  unsigned size() const { return static_cast<unsigned>(workers.size()); }
+
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F task) {
+    typedef typename std::result_of<F()>::type Result;
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    std::future<Result> result = packaged->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push([packaged]() { (*packaged)(); });
+    }
+    ready.notify_one();
+    return result;
+  }
+};
+
+#endif //PROGRAM_THREAD_POOL_H
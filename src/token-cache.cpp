@@ -0,0 +1,157 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <utility>
+#include "interpreter.h"
+
+// File layout: the header, tokenCount tokens, symbolCount + 1 offsets into the
+// names, then the names themselves. Symbols are numbered by position.
+struct TokenCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  uint64_t sourceHash;
+  uint64_t tokenCount;
+  uint64_t symbolCount;
+  uint64_t namesSize;
+};
+
+static const char TOKEN_CACHE_MAGIC[4] = {'P', 'T', 'O', 'K'};
+
+static_assert(sizeof(TokenCacheHeader) % alignof(Token) == 0, "Tokens have to stay aligned after the header.");
+
+// Mixes in eight bytes at a time; this only has to tell sources apart, not resist attacks.
+uint64_t TokenCache::hash(const SourceBuffer& source) {
+  const uint64_t MULTIPLIER = 0xff51afd7ed558ccdULL;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ source.size();
+  const char* c = source.begin();
+  for (; source.end() - c >= 8; c += 8) {
+    uint64_t word;
+    std::memcpy(&word, c, 8);
+    h = (h ^ word) * MULTIPLIER;
+    h ^= h >> 32;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, c, source.end() - c);
+  h = (h ^ tail) * MULTIPLIER;
+  return h ^ (h >> 29);
+}
+
+std::shared_ptr<TokenCache> TokenCache::load(const std::string& path, const SourceBuffer& source) {
+  return load(path, source.size(), hash(source));
+}
+
+std::shared_ptr<TokenCache> TokenCache::load(const std::string& path, size_t sourceSize, uint64_t sourceHash) {
+  std::shared_ptr<SourceBuffer> file;
+  try {
+    file = SourceBuffer::fromFile(path);
+  } catch (const std::invalid_argument&) {
+    return nullptr;
+  }
+  TokenCacheHeader header {};
+  if (file->size() < sizeof(header)) {
+    return nullptr;
+  }
+  std::memcpy(&header, file->begin(), sizeof(header));
+  if (std::memcmp(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION ||
+      header.sourceSize != sourceSize || header.sourceHash != sourceHash || header.tokenCount == 0) {
+    return nullptr;
+  }
+  if (header.tokenCount > file->size() / sizeof(Token) || header.symbolCount >= file->size() / sizeof(uint32_t) ||
+      header.namesSize > file->size()) {
+    return nullptr;
+  }
+  size_t tokensAt = sizeof(header);
+  size_t offsetsAt = tokensAt + header.tokenCount * sizeof(Token);
+  size_t namesAt = offsetsAt + (header.symbolCount + 1) * sizeof(uint32_t);
+  if (namesAt + header.namesSize != file->size()) {
+    return nullptr;
+  }
+
+  auto cache = std::shared_ptr<TokenCache>(new TokenCache);
+  cache->first = reinterpret_cast<const Token*>(file->begin() + tokensAt);
+  cache->last = cache->first + header.tokenCount;
+  if (cache->last[-1].type != Token::Type::END_OF_FILE) {
+    return nullptr;
+  }
+  // The parser trusts token types and symbols, so a damaged one must not get past here.
+  for (const Token* token = cache->first; token != cache->last; ++token) {
+    if (token->type > Token::Type::END_OF_FILE || (token->type == Token::Type::ID && token->symbol >= header.symbolCount)) {
+      return nullptr;
+    }
+  }
+  cache->symbols = std::make_shared<Interner>();
+  const char* names = file->begin() + namesAt;
+  uint32_t from = 0;
+  for (uint64_t symbol = 0; symbol < header.symbolCount; ++symbol) {
+    uint32_t to;
+    std::memcpy(&to, file->begin() + offsetsAt + (symbol + 1) * sizeof(uint32_t), sizeof(to));
+    if (to < from || to > header.namesSize || cache->symbols->intern(names + from, to - from) != symbol) {
+      return nullptr;
+    }
+    from = to;
+  }
+  cache->file = std::move(file);
+  return cache;
+}
+
+bool TokenCache::save(const std::string& path, const SourceBuffer& source, const std::vector<Token>& tokens, const Interner& symbols) {
+  TokenCacheHeader header {};
+  std::memcpy(header.magic, TOKEN_CACHE_MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.sourceSize = source.size();
+  header.sourceHash = hash(source);
+  header.tokenCount = tokens.size();
+  header.symbolCount = symbols.size();
+  std::vector<uint32_t> offsets = {0};
+  for (Symbol symbol = 0; symbol < symbols.size(); ++symbol) {
+    header.namesSize += symbols.name(symbol).size();
+    offsets.push_back(static_cast<uint32_t>(header.namesSize));
+  }
+
+  // Written next to the target and renamed over it, so concurrent runs never
+  // see a half written cache.
+  std::string temporary = path + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(tokens.data()), static_cast<std::streamsize>(tokens.size() * sizeof(Token)));
+    out.write(reinterpret_cast<const char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(uint32_t)));
+    for (Symbol symbol = 0; symbol < symbols.size(); ++symbol) {
+      out.write(symbols.name(symbol).data(), static_cast<std::streamsize>(symbols.name(symbol).size()));
+    }
+    if (!out.flush()) {
+      out.close();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<TokenCache> TokenCache::open(const std::string& directory, const SourceBuffer& source) {
+  uint64_t sourceHash = hash(source);
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.tokens", static_cast<unsigned long long>(sourceHash));
+  std::string path = directory + "/" + name;
+  if (auto cache = load(path, source.size(), sourceHash)) {
+    return cache;
+  }
+
+  auto symbols = std::make_shared<Interner>();
+  std::vector<Token> tokens;
+  try {
+    tokens = tokenize(SourceBuffer::fromView(source.begin(), source.size()), symbols);
+  } catch (const std::invalid_argument&) {
+    return nullptr;
+  }
+  if (!save(path, source, tokens, *symbols)) {
+    return nullptr;
+  }
+  return load(path, source.size(), sourceHash);
+}
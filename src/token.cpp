@@ -1,9 +1,117 @@
 #include <utility>
+#include <type_traits>
 
 #include "interpreter.h"
 
+static_assert(sizeof(Token) == 16, "Tokens are meant to stay 16 bytes.");
+static_assert(std::is_trivially_copyable<Token>::value, "Tokens are copied with memcpy.");
+
 Token::Token(Token::Type type): type(type) {}
 
-Token::Token(Token::Type type, int value): type(type), value(value) {}
+Token::Token(Token::Type type, int64_t value): type(type), value(value) {}
+
+// Clears the whole payload first, so identical tokens compare equal byte for byte.
+Token::Token(Symbol symbol, Token::Type type): type(type), value(0) {
+  this->symbol = symbol;
+}
+
+std::string_view Token::text(const SourceBuffer& source) const {
+  return std::string_view(source.begin() + offset, length);
+}
+
+// Keyword characters are all letters, so clearing the lowercase bit is enough to fold case.
+static bool matchesKeyword(const char* text, const char* keyword, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    if ((text[i] & ~0x20) != keyword[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Token::Type keywordType(const char* text, size_t length) {
+  switch (length) {
+    case 3:
+      switch (text[0] & ~0x20) {
+        case 'E':
+          if (matchesKeyword(text, "END", 3)) return Token::Type::END;
+          break;
+        case 'V':
+          if (matchesKeyword(text, "VAR", 3)) return Token::Type::VAR;
+          break;
+      }
+      break;
+    case 4:
+      if (matchesKeyword(text, "TRUE", 4)) return Token::Type::TRUE;
+      break;
+    case 5:
+      switch (text[0] & ~0x20) {
+        case 'B':
+          if (matchesKeyword(text, "BEGIN", 5)) return Token::Type::BEGIN;
+          break;
+        case 'F':
+          if (matchesKeyword(text, "FALSE", 5)) return Token::Type::FALSE;
+          break;
+      }
+      break;
+    case 7:
+      switch (text[0] & ~0x20) {
+        case 'B':
+          if (matchesKeyword(text, "BOOLEAN", 7)) return Token::Type::BOOLEAN;
+          break;
+        case 'I':
+          if (matchesKeyword(text, "INTEGER", 7)) return Token::Type::INTEGER;
+          break;
+        case 'P':
+          if (matchesKeyword(text, "PROGRAM", 7)) return Token::Type::PROGRAM;
+          break;
+      }
+      break;
+    case 8:
+      if (matchesKeyword(text, "FUNCTION", 8)) return Token::Type::FUNCTION;
+      break;
+    case 9:
+      if (matchesKeyword(text, "PROCEDURE", 9)) return Token::Type::PROCEDURE;
+      break;
+  }
+  return Token::Type::ID;
+}
 
-Token::Token(std::string name, Token::Type type, int value): name(std::move(name)), type(type), value(value) {}
\ No newline at end of file
+const char* tokenName(Token::Type type) {
+  switch (type) {
+    case Token::Type::PROGRAM: return "PROGRAM";
+    case Token::Type::BEGIN: return "BEGIN";
+    case Token::Type::END: return "END";
+    case Token::Type::DOT: return ".";
+    case Token::Type::SEMI: return ";";
+    case Token::Type::COLON: return ":";
+    case Token::Type::COMMA: return ",";
+    case Token::Type::VAR: return "VAR";
+    case Token::Type::ASSIGN: return ":=";
+    case Token::Type::EQUAL: return "==";
+    case Token::Type::NOT_EQUAL: return "!=";
+    case Token::Type::AND: return "&&";
+    case Token::Type::OR: return "||";
+    case Token::Type::LESS: return "<";
+    case Token::Type::LESS_EQUAL: return "<=";
+    case Token::Type::GREATER: return ">";
+    case Token::Type::GREATER_EQUAL: return ">=";
+    case Token::Type::NOT: return "!";
+    case Token::Type::PLUS: return "+";
+    case Token::Type::MINUS: return "-";
+    case Token::Type::MULTPLY: return "*";
+    case Token::Type::DIVIDE: return "/";
+    case Token::Type::LEFT_PAREN: return "(";
+    case Token::Type::RIGHT_PAREN: return ")";
+    case Token::Type::ID: return "identifier";
+    case Token::Type::TRUE: return "TRUE";
+    case Token::Type::FALSE: return "FALSE";
+    case Token::Type::INTEGER_CONST: return "integer";
+    case Token::Type::INTEGER: return "INTEGER";
+    case Token::Type::BOOLEAN: return "BOOLEAN";
+    case Token::Type::FUNCTION: return "FUNCTION";
+    case Token::Type::PROCEDURE: return "PROCEDURE";
+    case Token::Type::END_OF_FILE: return "end of file";
+  }
+  return "token";
+}
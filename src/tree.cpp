@@ -1,19 +1,26 @@
 #include <utility>
 #include "interpreter.h"
 
-Num::Num(int value): value(value) {}
+Num::Num(int64_t value): value(value) {}
 Boolean::Boolean(bool value): value(value) {}
-Var::Var(std::string val): name(std::move(val)) {}
+Var::Var(Symbol symbol): symbol(symbol) {}
 
-UnaryOp::UnaryOp(Token op, std::shared_ptr<AST> node): op(std::move(op)), node(std::move(node)) {}
+UnaryOp::UnaryOp(Token op, AST* node): op(op), node(node) {}
 
-BinaryOp::BinaryOp(std::shared_ptr<AST> left, Token op, std::shared_ptr<AST> right): op(std::move(op)) {
-  this->left = std::move(left);
-  this->right = std::move(right);
-}
+BinaryOp::BinaryOp(AST* left, Token op, AST* right): left(left), op(op), right(right) {}
 
-Program::Program(std::shared_ptr<AST> programName, std::shared_ptr<AST> block): name(std::move(programName)), block(std::move(block)) {}
+Program::Program(AST* programName, AST* block): name(programName), block(block) {}
 
-Block::Block(std::vector<std::shared_ptr<AST>> declarations, std::shared_ptr<AST> compoundStatement): declarations(std::move(declarations)), compoundStatement(std::move(compoundStatement)) {}
+Block::Block(NodeList declarations, AST* compoundStatement): declarations(declarations), compoundStatement(compoundStatement) {}
 
-Assign::Assign(std::shared_ptr<AST> left, std::shared_ptr<AST> right): left(std::move(left)), right(std::move(right)) {}
\ No newline at end of file
+Assign::Assign(AST* left, AST* right): left(left), right(right) {}
+
+AST* FunctionDecl::body() {
+  if (block == nullptr && deferred != nullptr) {
+    if (deferred->block == nullptr) {
+      deferred->block = deferred->parser->deferredBlock(deferred->mark, deferred->depth);
+    }
+    block = deferred->block;
+  }
+  return block;
+}
\ No newline at end of file
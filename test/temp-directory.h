@@ -0,0 +1,34 @@
+//
+// Scratch directories for tests that write files.
+//
+
+#ifndef PROGRAM_TEMP_DIRECTORY_H
+#define PROGRAM_TEMP_DIRECTORY_H
+
+#include <filesystem>
+#include <random>
+#include <string>
+
+// A fresh directory under the system temp directory for files a test writes,
+// removed with everything in it when the test ends, even on a failed REQUIRE.
+class TempDirectory {
+public:
+  explicit TempDirectory(const std::string& name)
+      : root(std::filesystem::temp_directory_path() / (name + "-" + std::to_string(std::random_device()()))) {
+    std::filesystem::create_directories(root);
+  }
+  ~TempDirectory() {
+    std::error_code ignored;
+    std::filesystem::remove_all(root, ignored);
+  }
+  TempDirectory(const TempDirectory&) = delete;
+  TempDirectory& operator=(const TempDirectory&) = delete;
+
+  std::string path() const { return root.string(); }
+  std::string file(const std::string& name) const { return (root / name).string(); }
+
+private:
+  std::filesystem::path root;
+};
+
+#endif //PROGRAM_TEMP_DIRECTORY_H
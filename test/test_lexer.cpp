@@ -0,0 +1,432 @@
+//
+// Created by kpfromer on 9/14/19.
+//
+
+#include "catch2.h"
+#include "interpreter.h"
+#include "scan.h"
+#include "temp-directory.h"
+#include <vector>
+#include <string>
+#include <fstream>
+
+TEST_CASE("Lexer", "[lexer]") {
+  auto source = SourceBuffer::fromString("6+2   - 3      * 10 / 5");
+  Lexer lexer(source);
+
+  SECTION("It gets an INTEGER_CONST token") {
+    Token token = lexer.getNextToken();
+    REQUIRE(token.type == Token::Type::INTEGER_CONST);
+    REQUIRE(token.value == 6);
+  }
+
+  SECTION("It gets every token in order") {
+    std::vector<Token::Type> expected = {
+        Token::Type::INTEGER_CONST, Token::Type::PLUS, Token::Type::INTEGER_CONST,
+        Token::Type::MINUS, Token::Type::INTEGER_CONST, Token::Type::MULTPLY,
+        Token::Type::INTEGER_CONST, Token::Type::DIVIDE, Token::Type::INTEGER_CONST,
+        Token::Type::END_OF_FILE
+    };
+    for (auto type : expected) {
+      REQUIRE(lexer.getNextToken().type == type);
+    }
+  }
+
+  SECTION("It can peek for tokens") {
+    Token peeked = lexer.peek(2);
+    Token current = lexer.getNextToken();
+    REQUIRE(peeked.type == Token::Type::PLUS);
+    REQUIRE(current.type == Token::Type::INTEGER_CONST);
+  }
+}
+
+TEST_CASE("Lexer reads across lines", "[lexer]") {
+  std::vector<std::string> lines;
+  lines.emplace_back("BEGIN { a comment");
+  lines.emplace_back("spanning lines } x := 10");
+  lines.emplace_back("END");
+  Lexer lexer(lines);
+
+  REQUIRE(lexer.getNextToken().type == Token::Type::BEGIN);
+  Token id = lexer.getNextToken();
+  REQUIRE(id.type == Token::Type::ID);
+  REQUIRE(lexer.interner()->name(id.symbol) == "x");
+  REQUIRE(lexer.getNextToken().type == Token::Type::ASSIGN);
+  REQUIRE(lexer.getNextToken().value == 10);
+  REQUIRE(lexer.getNextToken().type == Token::Type::END);
+  REQUIRE(lexer.getNextToken().type == Token::Type::END_OF_FILE);
+}
+
+TEST_CASE("Lexer peeks from its lookahead buffer", "[lexer]") {
+  auto source = SourceBuffer::fromString("BEGIN { comment } x := a + (b * 2); y := x END");
+  Lexer lexer(source);
+  lexer.countScans(true);
+
+  REQUIRE(lexer.peek(2).type == Token::Type::ID);
+  REQUIRE(lexer.peek().type == Token::Type::BEGIN);
+  REQUIRE(lexer.getNextToken().type == Token::Type::BEGIN);
+  REQUIRE(lexer.peek(2).type == Token::Type::ASSIGN);
+  REQUIRE(lexer.interner()->name(lexer.peek(1).symbol) == "x");
+
+  int count = 0;
+  while (lexer.peek(2).type != Token::Type::END_OF_FILE || lexer.peek().type != Token::Type::END_OF_FILE) {
+    lexer.peek();
+    lexer.getNextToken();
+    count++;
+  }
+  REQUIRE(count == 14);
+
+  for (unsigned scanned : lexer.scanCounts()) {
+    REQUIRE(scanned == 1);
+  }
+}
+
+TEST_CASE("Lexer recognizes every operator", "[lexer]") {
+  Lexer lexer(SourceBuffer::fromString("a:=b<=c<d>=e>f==g!=h&&i||!j:k;(l),m.n+o-p*q/r"));
+  std::vector<Token::Type> operators;
+  for (Token token = lexer.getNextToken(); token.type != Token::Type::END_OF_FILE; token = lexer.getNextToken()) {
+    if (token.type != Token::Type::ID) {
+      operators.push_back(token.type);
+    }
+  }
+  std::vector<Token::Type> expected = {
+      Token::Type::ASSIGN, Token::Type::LESS_EQUAL, Token::Type::LESS, Token::Type::GREATER_EQUAL,
+      Token::Type::GREATER, Token::Type::EQUAL, Token::Type::NOT_EQUAL, Token::Type::AND,
+      Token::Type::OR, Token::Type::NOT, Token::Type::COLON, Token::Type::SEMI,
+      Token::Type::LEFT_PAREN, Token::Type::RIGHT_PAREN, Token::Type::COMMA, Token::Type::DOT,
+      Token::Type::PLUS, Token::Type::MINUS, Token::Type::MULTPLY, Token::Type::DIVIDE
+  };
+  REQUIRE(operators == expected);
+
+  REQUIRE_THROWS(Lexer(SourceBuffer::fromString("a = b")).peek(2));
+  REQUIRE_THROWS(Lexer(SourceBuffer::fromString("a & b")).peek(2));
+}
+
+TEST_CASE("Integer literals are 64-bit and checked for overflow", "[lexer]") {
+  Lexer lexer(SourceBuffer::fromString("2147483647 2147483648 9223372036854775807 007"));
+  Token narrow = lexer.getNextToken();
+  REQUIRE(narrow.value == 2147483647);
+  REQUIRE(narrow.flags == 0);
+  Token wide = lexer.getNextToken();
+  REQUIRE(wide.value == 2147483648LL);
+  REQUIRE((wide.flags & Token::WIDE) != 0);
+  REQUIRE(lexer.getNextToken().value == INT64_MAX);
+  REQUIRE(lexer.getNextToken().value == 7);
+
+  Lexer overflow(SourceBuffer::fromString("x := 9223372036854775808"));
+  overflow.getNextToken();
+  overflow.getNextToken();
+  REQUIRE_THROWS_WITH(overflow.getNextToken(), "Integer literal out of range at offset 5.");
+}
+
+TEST_CASE("Scan kernels agree with the scalar scanner", "[lexer]") {
+  std::string text;
+  const std::string pieces[] = {
+      " ", "    ", "\t\t", "\r\n", "\n\n\n      ", "abc", "Z9z0", "identifier123", "x",
+      "}", "{", ":=", "+", "@", "_", "\x80", "\xff", "`", "[", "/", "0123456789"
+  };
+  unsigned seed = 7;
+  for (int i = 0; i < 4000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    text += pieces[(seed >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+  }
+  const char* begin = text.data();
+  const char* end = begin + text.size();
+
+  const ScanKernels* scalar = scanKernels(ScanKernels::Level::SCALAR);
+  const ScanKernels::Level levels[] = {ScanKernels::Level::SSE2, ScanKernels::Level::AVX2};
+  for (auto level : levels) {
+    const ScanKernels* kernels = scanKernels(level);
+    if (kernels == nullptr) {
+      continue;
+    }
+    for (const char* start = begin; start < end; ++start) {
+      REQUIRE(kernels->whitespace(start, end) == scalar->whitespace(start, end));
+      REQUIRE(kernels->commentEnd(start, end) == scalar->commentEnd(start, end));
+      REQUIRE(kernels->identifier(start, end) == scalar->identifier(start, end));
+    }
+  }
+}
+
+TEST_CASE("Keywords are case-insensitive", "[lexer]") {
+  REQUIRE(keywordType("BeGin", 5) == Token::Type::BEGIN);
+  REQUIRE(keywordType("eNd", 3) == Token::Type::END);
+  REQUIRE(keywordType("program", 7) == Token::Type::PROGRAM);
+  REQUIRE(keywordType("Procedure", 9) == Token::Type::PROCEDURE);
+  REQUIRE(keywordType("ENDS", 4) == Token::Type::ID);
+  REQUIRE(keywordType("BEGIN1", 6) == Token::Type::ID);
+  REQUIRE(keywordType("E0D", 3) == Token::Type::ID);
+  REQUIRE(keywordType("x", 1) == Token::Type::ID);
+
+  Lexer lexer(SourceBuffer::fromString("true False"));
+  Token yes = lexer.getNextToken();
+  Token no = lexer.getNextToken();
+  REQUIRE(yes.type == Token::Type::TRUE);
+  REQUIRE(yes.value == 1);
+  REQUIRE(no.type == Token::Type::FALSE);
+  REQUIRE(no.value == 0);
+}
+
+TEST_CASE("Identifiers are interned", "[lexer]") {
+  Lexer lexer(SourceBuffer::fromString("count Total COUNT total other"));
+  Symbol count = lexer.getNextToken().symbol;
+  Symbol total = lexer.getNextToken().symbol;
+  REQUIRE(lexer.getNextToken().symbol == count);
+  REQUIRE(lexer.getNextToken().symbol == total);
+  Symbol other = lexer.getNextToken().symbol;
+  REQUIRE(count != total);
+  REQUIRE(other != count);
+  REQUIRE(other != total);
+  REQUIRE(lexer.interner()->name(total) == "Total");
+  REQUIRE(lexer.interner()->size() == 3);
+}
+
+TEST_CASE("Interner keeps symbols stable while it grows", "[lexer]") {
+  Interner interner;
+  std::vector<Symbol> symbols;
+  for (int i = 0; i < 1000; ++i) {
+    symbols.push_back(interner.intern("v" + std::to_string(i)));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    REQUIRE(interner.intern("V" + std::to_string(i)) == symbols[i]);
+    REQUIRE(symbols[i] == static_cast<Symbol>(i));
+  }
+}
+
+TEST_CASE("Lexer streams chunks from a file descriptor", "[lexer]") {
+  std::string program =
+      "PROGRAM streamed; { a comment that is longer than any chunk }\n"
+      "VAR alpha, beta : INTEGER;\n"
+      "BEGIN\n"
+      "    alpha := 12345 * (beta + 7);\n"
+      "    beta := alpha <= 10 && beta != 3 || !TRUE;\n"
+      "    longIdentifierName := alpha >= beta\n"
+      "END.";
+
+  std::vector<Token> expected;
+  Lexer buffered(SourceBuffer::fromString(program));
+  for (Token token = buffered.getNextToken(); token.type != Token::Type::END_OF_FILE; token = buffered.getNextToken()) {
+    expected.push_back(token);
+  }
+
+  for (size_t chunkSize = 1; chunkSize <= 9; ++chunkSize) {
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    fwrite(program.data(), 1, program.size(), file);
+    fflush(file);
+    rewind(file);
+
+    Lexer streamed(std::make_shared<SourceStream>(fileno(file)), nullptr, chunkSize);
+    streamed.countScans(true);
+    for (const auto& token : expected) {
+      Token actual = streamed.getNextToken();
+      REQUIRE(actual.type == token.type);
+      REQUIRE(actual.value == token.value);
+      if (token.type == Token::Type::ID) {
+        REQUIRE(streamed.interner()->name(actual.symbol) == buffered.interner()->name(token.symbol));
+      }
+    }
+    REQUIRE(streamed.getNextToken().type == Token::Type::END_OF_FILE);
+    REQUIRE(streamed.scanCounts().size() == program.size());
+    for (unsigned scanned : streamed.scanCounts()) {
+      REQUIRE(scanned == 1);
+    }
+    fclose(file);
+  }
+}
+
+TEST_CASE("Parallel tokenizing matches the serial lexer", "[lexer]") {
+  std::string program = "PROGRAM chunks;\nBEGIN\n";
+  for (int i = 0; i < 20000; ++i) {
+    program += "  v" + std::to_string(i % 113) + " := w" + std::to_string(i % 7) + " + " + std::to_string(i) + ";";
+    if (i % 50 == 0) {
+      // Long comments make chunks start inside a comment.
+      program += " { x := y; ";
+      program += std::string(static_cast<size_t>(i % 4000), ' ');
+      program += " z := 1 }";
+    }
+    program += "\n";
+  }
+  program += "  done := 1\nEND.\n";
+  auto source = SourceBuffer::fromString(program);
+
+  auto serialSymbols = std::make_shared<Interner>();
+  auto serial = tokenize(source, serialSymbols);
+  for (unsigned threads : {1u, 2u, 3u, 8u}) {
+    auto parallelSymbols = std::make_shared<Interner>();
+    auto parallel = tokenizeParallel(source, parallelSymbols, threads);
+    REQUIRE(parallel.size() == serial.size());
+    for (size_t i = 0; i < serial.size(); ++i) {
+      REQUIRE(parallel[i].type == serial[i].type);
+      REQUIRE(parallel[i].offset == serial[i].offset);
+      REQUIRE(parallel[i].value == serial[i].value);
+      REQUIRE(parallel[i].symbol == serial[i].symbol);
+    }
+    REQUIRE(parallelSymbols->size() == serialSymbols->size());
+  }
+
+  auto broken = SourceBuffer::fromString(program + " @");
+  REQUIRE_THROWS(tokenizeParallel(broken, std::make_shared<Interner>(), 4));
+}
+
+TEST_CASE("Parallel tokenizing keeps the serial lexer's spellings", "[lexer]") {
+  // A chunk that starts inside a comment lexes the text up to the next '{' as
+  // identifiers, then agrees with the serial lexer after the '}'. The dropped
+  // identifiers' spellings must not win over the ones really used.
+  std::string program = "PROGRAM spellings;\nBEGIN\n";
+  for (int i = 0; i < 20000; ++i) {
+    std::string name = "fresh" + std::to_string(i);
+    if (i % 50 == 0) {
+      program += " { " + name + " := 1; ";
+      program += std::string(static_cast<size_t>(i % 4000), ' ');
+      program += " FRESH" + std::to_string(i) + " := 2 { again }";
+    }
+    program += "  " + name + " := " + std::to_string(i) + ";\n";
+  }
+  program += "END.\n";
+  auto source = SourceBuffer::fromString(program);
+
+  auto serialSymbols = std::make_shared<Interner>();
+  auto serial = tokenize(source, serialSymbols);
+  for (unsigned threads : {2u, 3u, 8u}) {
+    auto parallelSymbols = std::make_shared<Interner>();
+    auto parallel = tokenizeParallel(source, parallelSymbols, threads);
+    REQUIRE(parallel.size() == serial.size());
+    for (size_t i = 0; i < serial.size(); ++i) {
+      if (serial[i].type == Token::Type::ID) {
+        REQUIRE(parallelSymbols->name(parallel[i].symbol) == serialSymbols->name(serial[i].symbol));
+      }
+    }
+  }
+}
+
+TEST_CASE("Parser reads pre-lexed tokens", "[lexer]") {
+  auto source = SourceBuffer::fromString("x := 1 + 2");
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = std::make_shared<const std::vector<Token>>(tokenize(source, symbols));
+  Lexer lexer(tokens, symbols);
+  REQUIRE(lexer.peek(2).type == Token::Type::ASSIGN);
+  REQUIRE(lexer.getNextToken().type == Token::Type::ID);
+  REQUIRE(lexer.getNextToken().type == Token::Type::ASSIGN);
+  REQUIRE(lexer.getNextToken().value == 1);
+  REQUIRE(lexer.peek(4).type == Token::Type::END_OF_FILE);
+  lexer.getNextToken();
+  lexer.getNextToken();
+  REQUIRE(lexer.getNextToken().type == Token::Type::END_OF_FILE);
+  REQUIRE(lexer.getNextToken().type == Token::Type::END_OF_FILE);
+}
+
+TEST_CASE("Tokens point back into the source", "[lexer]") {
+  auto source = SourceBuffer::fromString("  alpha:=  { note } 1234 <= beta");
+  Lexer lexer(source);
+  std::vector<std::string> texts;
+  for (Token token = lexer.getNextToken(); token.type != Token::Type::END_OF_FILE; token = lexer.getNextToken()) {
+    texts.emplace_back(token.text(*source));
+  }
+  REQUIRE(texts == std::vector<std::string>{"alpha", ":=", "1234", "<=", "beta"});
+  REQUIRE(sizeof(Token) == 16);
+}
+
+TEST_CASE("Incremental lexing matches lexing from scratch", "[lexer]") {
+  std::string program = "PROGRAM edits;\nBEGIN\n";
+  for (int i = 0; i < 200; ++i) {
+    program += "  v" + std::to_string(i % 13) + " := w + " + std::to_string(i) + " { note " + std::to_string(i) + " };\n";
+  }
+  program += "END.\n";
+  IncrementalLexer document(program);
+
+  const std::string pieces[] = {"", " ", "a", "7", "{", "}", ":", "=", "<", "BEGIN ", "x1 := 2;", "{ c }", "\n"};
+  unsigned seed = 7;
+  auto next = [&seed](size_t bound) {
+    seed = seed * 1103515245u + 12345u;
+    return static_cast<size_t>(seed >> 16) % bound;
+  };
+  for (int edit = 0; edit < 500; ++edit) {
+    size_t offset = next(document.getText().size() + 1);
+    size_t removed = next(std::min<size_t>(6, document.getText().size() - offset) + 1);
+    const std::string& inserted = pieces[next(sizeof(pieces) / sizeof(pieces[0]))];
+    auto before = document.getTokens().size();
+    IncrementalLexer::Change change {};
+    try {
+      change = document.edit(offset, removed, inserted);
+    } catch (const std::invalid_argument&) {
+      // Edits can leave a lone '=' behind; those are rolled back.
+      REQUIRE(document.getTokens().size() == before);
+      continue;
+    }
+    REQUIRE(document.getTokens().size() == before - change.removed + change.inserted);
+
+    auto symbols = std::make_shared<Interner>();
+    auto expected = tokenize(SourceBuffer::fromString(document.getText()), symbols);
+    const auto& tokens = document.getTokens();
+    REQUIRE(tokens.size() == expected.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      REQUIRE(tokens[i].type == expected[i].type);
+      REQUIRE(tokens[i].offset == expected[i].offset);
+      REQUIRE(tokens[i].length == expected[i].length);
+      if (tokens[i].type == Token::Type::ID) {
+        REQUIRE(tokens[i].symbol == document.interner()->intern(symbols->name(expected[i].symbol)));
+      } else {
+        REQUIRE(tokens[i].value == expected[i].value);
+      }
+    }
+  }
+
+  std::string text = document.getText();
+  REQUIRE_THROWS(document.edit(0, 0, "@"));
+  REQUIRE(document.getText() == text);
+  REQUIRE_THROWS(document.edit(text.size(), 1, ""));
+}
+
+TEST_CASE("Token caches replay the tokens they were saved with", "[lexer]") {
+  auto source = SourceBuffer::fromString("PROGRAM cached; BEGIN alpha := 9000000000 + beta; Alpha := 2 END.");
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = tokenize(source, symbols);
+  TempDirectory directory("token-cache-test");
+  const std::string path = directory.file("cached.tokens");
+  REQUIRE(TokenCache::save(path, *source, tokens, *symbols));
+
+  auto cache = TokenCache::load(path, *source);
+  REQUIRE(cache != nullptr);
+  REQUIRE(cache->size() == tokens.size());
+  REQUIRE(cache->interner()->size() == symbols->size());
+  Lexer lexer(cache);
+  for (const Token& token : tokens) {
+    Token replayed = lexer.getNextToken();
+    REQUIRE(replayed.type == token.type);
+    REQUIRE(replayed.offset == token.offset);
+    REQUIRE(replayed.length == token.length);
+    if (token.type == Token::Type::ID) {
+      REQUIRE(lexer.interner()->name(replayed.symbol) == symbols->name(token.symbol));
+    } else {
+      REQUIRE(replayed.value == token.value);
+    }
+  }
+
+  REQUIRE(TokenCache::load(path, *SourceBuffer::fromString("PROGRAM other; BEGIN END.")) == nullptr);
+  // Tokens start right after the 48 byte header; the second one is the ID "cached".
+  const std::streamoff secondToken = 48 + sizeof(Token);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(secondToken + 8);
+    const char symbol[] = {'\xff', '\xff', '\xff', '\x7f'};
+    file.write(symbol, sizeof(symbol));
+  }
+  REQUIRE(TokenCache::load(path, *source) == nullptr);
+  REQUIRE(TokenCache::save(path, *source, tokens, *symbols));
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(secondToken);
+    file.put('\x7f');
+  }
+  REQUIRE(TokenCache::load(path, *source) == nullptr);
+  REQUIRE(TokenCache::save(path, *source, tokens, *symbols));
+  REQUIRE(TokenCache::load(path, *source) != nullptr);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(4);
+    file.put('\x7f');
+  }
+  REQUIRE(TokenCache::load(path, *source) == nullptr);
+  REQUIRE(TokenCache::load(directory.file("missing.tokens"), *source) == nullptr);
+}
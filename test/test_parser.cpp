@@ -2,3 +2,778 @@
 // Created by kpfromer on 9/14/19.
 //
 
+#include "catch2.h"
+#include "interpreter.h"
+#include "temp-directory.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+
+namespace {
+
+struct Run {
+  std::shared_ptr<Interner> symbols;
+  std::shared_ptr<ActivationRecord> globals;
+  // Function values in globals point into the tree.
+  std::shared_ptr<Arena> nodes;
+};
+
+Run run(const std::string& program) {
+  Parser parser(SourceBuffer::fromString(program));
+  PrintVisitor printer(parser.interner());
+  auto root = parser.program();
+  auto& node = dynamic_cast<Program&>(*root);
+  node.name->accept(printer);
+  printer.callstack = std::make_shared<ActivationRecord>(printer.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+  node.block->accept(printer);
+  return Run{parser.interner(), printer.callstack, parser.arena()};
+}
+
+int64_t valueOf(const Run& ran, const std::string& name) {
+  auto value = ran.globals->get(ran.symbols->intern(name));
+  REQUIRE(value != nullptr);
+  return dynamic_cast<NumberValue&>(*value).value;
+}
+
+// Same nodes in the same places; symbols, kept in values, are not compared.
+void sameShape(const FlatTree& tree, const FlatTree& expected) {
+  REQUIRE(tree.kinds == expected.kinds);
+  REQUIRE(tree.ops == expected.ops);
+  REQUIRE(tree.childStart == expected.childStart);
+  REQUIRE(tree.children == expected.children);
+}
+
+void sameTree(const FlatTree& tree, const FlatTree& expected) {
+  sameShape(tree, expected);
+  REQUIRE(tree.values == expected.values);
+}
+
+// A small LCG, so randomly built programs and edits are the same on every run.
+class Random {
+public:
+  explicit Random(unsigned seed): seed(seed) {}
+  unsigned operator()(unsigned bound) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) % bound;
+  }
+
+private:
+  unsigned seed;
+};
+
+}
+
+TEST_CASE("Parser evaluates assignments", "[parser]") {
+  auto ran = run(
+      "PROGRAM test;\n"
+      "BEGIN\n"
+      "  a := 2;\n"
+      "  b := 10 * a + 10 * a / 4;\n"
+      "  c := a - - b;\n"
+      "  d := (1 + 2) * 3 <= 9\n"
+      "END.\n");
+  REQUIRE(valueOf(ran, "a") == 2);
+  REQUIRE(valueOf(ran, "b") == 25);
+  REQUIRE(valueOf(ran, "c") == 27);
+  REQUIRE(valueOf(ran, "d") == 1);
+}
+
+TEST_CASE("Identifiers are case-insensitive", "[parser]") {
+  auto ran = run("PROGRAM test; BEGIN number := 2; a := NUMBER; b := NumBer * a END.");
+  REQUIRE(valueOf(ran, "number") == 2);
+  REQUIRE(valueOf(ran, "A") == 2);
+  REQUIRE(valueOf(ran, "b") == 4);
+}
+
+TEST_CASE("Arithmetic is 64-bit", "[parser]") {
+  auto ran = run("PROGRAM test; BEGIN big := 3000000000 * 3; small := big - 8999999999 END.");
+  REQUIRE(valueOf(ran, "big") == 9000000000LL);
+  REQUIRE(valueOf(ran, "small") == 1);
+}
+
+TEST_CASE("Syntax errors are collected with positions", "[parser]") {
+  Parser parser(SourceBuffer::fromString(
+      "PROGRAM test;\n"
+      "BEGIN\n"
+      "  a := 1 +;\n"
+      "  b := 2 @ 3;\n"
+      "  c := (4\n"
+      "  d := 99999999999999999999;\n"
+      "  BEGIN e := * END\n"
+      "END.\n"));
+  auto diagnostics = std::make_shared<Diagnostics>();
+  parser.setDiagnostics(diagnostics);
+  parser.program();
+
+  REQUIRE(diagnostics->size() == 6);
+  REQUIRE((*diagnostics)[0].code == DiagnosticCode::EXPECTED_EXPRESSION);
+  REQUIRE(diagnostics->position((*diagnostics)[0].offset).line == 3);
+  REQUIRE(diagnostics->position((*diagnostics)[0].offset).column == 11);
+  REQUIRE((*diagnostics)[1].code == DiagnosticCode::INVALID_CHARACTER);
+  REQUIRE((*diagnostics)[2].code == DiagnosticCode::UNEXPECTED_TOKEN);
+  REQUIRE((*diagnostics)[2].expected == Token::Type::SEMI);
+  REQUIRE((*diagnostics)[2].found == Token::Type::INTEGER_CONST);
+  REQUIRE((*diagnostics)[3].code == DiagnosticCode::UNEXPECTED_TOKEN);
+  REQUIRE((*diagnostics)[3].expected == Token::Type::RIGHT_PAREN);
+  REQUIRE((*diagnostics)[3].found == Token::Type::ID);
+  REQUIRE((*diagnostics)[4].code == DiagnosticCode::INTEGER_OUT_OF_RANGE);
+  REQUIRE(diagnostics->position((*diagnostics)[4].offset).line == 6);
+  REQUIRE((*diagnostics)[5].code == DiagnosticCode::EXPECTED_EXPRESSION);
+  REQUIRE(diagnostics->position((*diagnostics)[5].offset).line == 7);
+
+  Parser throwing(SourceBuffer::fromString("PROGRAM test; BEGIN a := END."));
+  REQUIRE_THROWS_WITH(throwing.program(), "Expected an expression at offset 25.");
+}
+
+TEST_CASE("Operators group by precedence and associate left", "[parser]") {
+  auto ran = run(
+      "PROGRAM test;\n"
+      "BEGIN\n"
+      "  a := 1 - 2 - 3;\n"
+      "  b := 64 / 4 / 2 * 3;\n"
+      "  c := 2 + 3 * 4 < 15 == 1;\n"
+      "  d := 1 || 0 && 0;\n"
+      "  e := 0 == 0 || 1;\n"
+      "  f := -2 * -(3 + 1) >= 8 && 2 != 3\n"
+      "END.\n");
+  REQUIRE(valueOf(ran, "a") == -4);
+  REQUIRE(valueOf(ran, "b") == 24);
+  REQUIRE(valueOf(ran, "c") == 1);
+  REQUIRE(valueOf(ran, "d") == 1);
+  REQUIRE(valueOf(ran, "e") == 0);
+  REQUIRE(valueOf(ran, "f") == 1);
+}
+
+TEST_CASE("Trees live in the parser's arena", "[parser]") {
+  std::shared_ptr<Arena> nodes;
+  AST* root;
+  {
+    Parser parser(SourceBuffer::fromString("PROGRAM test; VAR a, b : INTEGER; BEGIN a := 1; b := (a + 2) * 3 END."));
+    root = parser.program();
+    nodes = parser.arena();
+  }
+  REQUIRE(nodes->bytesUsed() >= 10 * sizeof(Num));
+  auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*root).block);
+  REQUIRE(block.declarations.size() == 2);
+  REQUIRE(dynamic_cast<Compound&>(*block.compoundStatement).children.size() == 2);
+
+  Arena arena(256);
+  auto* small = arena.make<Num>(1);
+  REQUIRE(reinterpret_cast<uintptr_t>(small) % alignof(Num) == 0);
+  auto* large = static_cast<char*>(arena.allocate(1000, 8));
+  auto* after = arena.make<Num>(2);
+  REQUIRE(reinterpret_cast<uintptr_t>(large) % 8 == 0);
+  REQUIRE(after->value == 2);
+  REQUIRE(arena.bytesReserved() < 2 * 256 + 1008);
+}
+
+TEST_CASE("Flat trees run like the pointer tree", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "VAR a, b : INTEGER;\n"
+      "FUNCTION twice;\n"
+      "BEGIN\n"
+      "  b := b * 2\n"
+      "END;\n"
+      "BEGIN\n"
+      "  b := 3;\n"
+      "  a := -(1 + 2) * 4 >= -12 && !(2 == 3);\n"
+      "  twice();\n"
+      "  b := b + twice\n"
+      "END.\n";
+  auto ran = run(program);
+
+  Parser parser(SourceBuffer::fromString(program));
+  FlatTree tree = FlatTree::fromTree(*parser.program());
+  REQUIRE(tree.kinds[0] == FlatTree::PROGRAM);
+  REQUIRE(tree.childStart.size() == tree.size() + 1);
+  for (FlatTree::Index node = 0; node < tree.size(); ++node) {
+    for (const FlatTree::Index* child = tree.childrenBegin(node); child != tree.childrenEnd(node); ++child) {
+      // Pre-order: children come after their parent.
+      REQUIRE(*child > node);
+    }
+  }
+
+  FlatInterpreter interpreter(parser.interner());
+  interpreter.run(tree, tree.child(0, 0));
+  interpreter.callstack = std::make_shared<ActivationRecord>(interpreter.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+  interpreter.run(tree, tree.child(0, 1));
+  for (const char* name : {"a", "b"}) {
+    auto flatValue = interpreter.callstack->get(parser.interner()->intern(name));
+    REQUIRE(flatValue != nullptr);
+    REQUIRE(dynamic_cast<NumberValue&>(*flatValue).value == valueOf(ran, name));
+  }
+}
+
+TEST_CASE("Calls to undefined functions are errors", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "BEGIN\n"
+      "  nope(1)\n"
+      "END.\n";
+  REQUIRE_THROWS_WITH(run(program), "Undefined function nope.");
+
+  Parser parser(SourceBuffer::fromString(program));
+  FlatTree tree = FlatTree::fromTree(*parser.program());
+  FlatInterpreter interpreter(parser.interner());
+  REQUIRE_THROWS_WITH(interpreter.run(tree, 0), "Undefined function nope.");
+}
+
+TEST_CASE("Long operator chains run without deep recursion", "[parser]") {
+  const int terms = 500000;
+  std::string program = "PROGRAM chain;\nVAR x : INTEGER;\nBEGIN\n  x := 1";
+  for (int i = 1; i < terms; ++i) {
+    program += " + 2 * 1";
+  }
+  program += "\nEND.\n";
+  auto ran = run(program);
+  REQUIRE(valueOf(ran, "x") == 2 * terms - 1);
+
+  Parser parser(SourceBuffer::fromString(program));
+  FlatTree tree = FlatTree::fromTree(*parser.program());
+  FlatInterpreter interpreter(parser.interner());
+  interpreter.run(tree, tree.child(0, 0));
+  interpreter.callstack = std::make_shared<ActivationRecord>(interpreter.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+  interpreter.run(tree, tree.child(0, 1));
+  auto value = interpreter.callstack->get(parser.interner()->intern("x"));
+  REQUIRE(value != nullptr);
+  REQUIRE(dynamic_cast<NumberValue&>(*value).value == 2 * terms - 1);
+}
+
+TEST_CASE("Function bodies can be parsed on first use", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "FUNCTION unused;\n"
+      "  FUNCTION inner;\n"
+      "  BEGIN x := 1 END;\n"
+      "BEGIN BEGIN y := 1 + END END;\n"
+      "FUNCTION used;\n"
+      "BEGIN\n"
+      "  b := 7\n"
+      "END;\n"
+      "BEGIN\n"
+      "  used()\n"
+      "END.\n";
+  for (bool replayed : {false, true}) {
+    auto source = SourceBuffer::fromString(program);
+    auto symbols = std::make_shared<Interner>();
+    std::unique_ptr<Parser> parser(replayed
+        ? new Parser(std::make_shared<const std::vector<Token>>(tokenize(source, symbols)), symbols)
+        : new Parser(source));
+    auto diagnostics = std::make_shared<Diagnostics>();
+    parser->setDiagnostics(diagnostics);
+    parser->setLazyFunctions(true);
+    auto root = parser->program();
+    REQUIRE(diagnostics->empty());
+
+    auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*root).block);
+    REQUIRE(block.declarations.size() == 2);
+    auto& unused = dynamic_cast<FunctionDecl&>(*block.declarations[0]);
+    auto& used = dynamic_cast<FunctionDecl&>(*block.declarations[1]);
+    REQUIRE(unused.block == nullptr);
+    REQUIRE(used.block == nullptr);
+
+    PrintVisitor printer(parser->interner());
+    root->accept(printer);
+    // The interpreter runs a copy of the declaration, which shares the parsed block.
+    REQUIRE(used.deferred->block != nullptr);
+    REQUIRE(unused.deferred->block == nullptr);
+    REQUIRE(diagnostics->empty());
+
+    unused.body();
+    REQUIRE(diagnostics->size() == 1);
+    REQUIRE((*diagnostics)[0].code == DiagnosticCode::EXPECTED_EXPRESSION);
+  }
+}
+
+TEST_CASE("Function bodies can be parsed in parallel", "[parser]") {
+  std::string program = "PROGRAM test;\nVAR a : INTEGER;\n";
+  for (int i = 0; i < 20; ++i) {
+    std::string name = "f" + std::to_string(i);
+    program += "FUNCTION " + name + "(x : INTEGER);\n";
+    if (i % 3 == 0) {
+      program += "  FUNCTION inner;\n  BEGIN a := a - 1 END;\n";
+    }
+    program += "BEGIN\n  a := a * 3 + " + std::to_string(i) + ";\n  BEGIN a := (a - 1) / 2 END\nEND;\n";
+  }
+  program += "BEGIN\n  a := 1;\n  f3();\n  f17()\nEND.\n";
+
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = std::make_shared<const std::vector<Token>>(tokenize(SourceBuffer::fromString(program), symbols));
+  Parser serial(tokens, symbols);
+  FlatTree expected = FlatTree::fromTree(*serial.program());
+
+  std::shared_ptr<Arena> nodes;
+  AST* root;
+  {
+    Parser parallel(tokens, symbols);
+    parallel.setParallelFunctions(true, 3);
+    root = parallel.program();
+    nodes = parallel.arena();
+  }
+  // The batch parsers are gone, but their nodes live on in the adopted arenas.
+  auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*root).block);
+  REQUIRE(block.declarations.size() == 21);
+  for (size_t i = 1; i < block.declarations.size(); ++i) {
+    REQUIRE(dynamic_cast<FunctionDecl&>(*block.declarations[i]).block != nullptr);
+  }
+  sameTree(FlatTree::fromTree(*root), expected);
+}
+
+TEST_CASE("Errors in parallel function bodies come out in source order", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "FUNCTION first;\n"
+      "BEGIN a := 1 + END;\n"
+      "FUNCTION second;\n"
+      "BEGIN b := * 2 END;\n"
+      "BEGIN\n"
+      "  c := ;\n"
+      "END.\n";
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = std::make_shared<const std::vector<Token>>(tokenize(SourceBuffer::fromString(program), symbols));
+  std::vector<std::shared_ptr<Diagnostics>> found;
+  for (bool parallel : {false, true}) {
+    Parser parser(tokens, symbols);
+    found.push_back(std::make_shared<Diagnostics>());
+    parser.setDiagnostics(found.back());
+    parser.setParallelFunctions(parallel, 2);
+    parser.program();
+  }
+  REQUIRE(found[0]->size() == 3);
+  REQUIRE(found[1]->size() == found[0]->size());
+  for (size_t i = 0; i < found[0]->size(); ++i) {
+    REQUIRE((*found[1])[i].offset == (*found[0])[i].offset);
+    REQUIRE((*found[1])[i].code == (*found[0])[i].code);
+  }
+}
+
+TEST_CASE("Malformed parallel function bodies are reported like serial ones", "[parser]") {
+  const std::string programs[] = {
+      // An unclosed BEGIN runs into the next FUNCTION.
+      "PROGRAM test;\nVAR a : INTEGER;\nFUNCTION f;\nBEGIN BEGIN a := 1 END;\n"
+      "FUNCTION g;\nBEGIN a := 2 END;\nBEGIN\n  a := 3\nEND.\n",
+      // Headers with result types are not in the grammar.
+      "PROGRAM test;\nVAR a : INTEGER;\nFUNCTION f(b : INTEGER) : INTEGER;\nBEGIN a := 1 END;\n"
+      "FUNCTION g(b : INTEGER) : INTEGER;\nBEGIN a := 2 END;\nBEGIN\n  a := 3\nEND.\n",
+      // Errors inside otherwise well-formed bodies.
+      "PROGRAM test;\nFUNCTION f;\nBEGIN a := 1 + END;\nFUNCTION g;\nBEGIN b := (2 END;\n"
+      "FUNCTION h;\nBEGIN c := 3 END;\nBEGIN\n  h()\nEND.\n",
+  };
+  for (const std::string& program : programs) {
+    auto symbols = std::make_shared<Interner>();
+    auto tokens = std::make_shared<const std::vector<Token>>(tokenize(SourceBuffer::fromString(program), symbols));
+    std::vector<std::shared_ptr<Diagnostics>> found;
+    std::vector<std::string> thrown;
+    for (bool parallel : {false, true}) {
+      Parser parser(tokens, symbols);
+      found.push_back(std::make_shared<Diagnostics>());
+      parser.setDiagnostics(found.back());
+      parser.setParallelFunctions(parallel, 2);
+      parser.program();
+
+      // Without diagnostics, the first error is thrown.
+      try {
+        Parser throwing(tokens, symbols);
+        throwing.setParallelFunctions(parallel, 2);
+        throwing.program();
+      } catch (const std::invalid_argument& error) {
+        thrown.push_back(error.what());
+      }
+    }
+    REQUIRE(!found[0]->empty());
+    REQUIRE(found[1]->size() == found[0]->size());
+    for (size_t i = 0; i < found[0]->size(); ++i) {
+      REQUIRE((*found[1])[i].offset == (*found[0])[i].offset);
+      REQUIRE((*found[1])[i].code == (*found[0])[i].code);
+      REQUIRE((*found[1])[i].expected == (*found[0])[i].expected);
+      REQUIRE((*found[1])[i].found == (*found[0])[i].found);
+    }
+    REQUIRE(thrown.size() == 2);
+    REQUIRE(thrown[1] == thrown[0]);
+  }
+}
+
+TEST_CASE("AST caches load the flat tree they were saved with", "[parser]") {
+  const std::string program =
+      "PROGRAM cached;\n"
+      "VAR total : INTEGER;\n"
+      "FUNCTION grow(step : INTEGER);\n"
+      "BEGIN total := total * 2 + 9000000000 END;\n"
+      "BEGIN\n"
+      "  total := -3;\n"
+      "  grow();\n"
+      "  Total := total && !(1 < 2)\n"
+      "END.\n";
+  auto source = SourceBuffer::fromString(program);
+  Parser parser(source);
+  FlatTree tree = FlatTree::fromTree(*parser.program());
+  TempDirectory directory("ast-cache-test");
+  const std::string path = directory.file("cached.ast");
+  REQUIRE(AstCache::save(path, *source, tree, *parser.interner()));
+
+  auto cache = AstCache::load(path, *source);
+  REQUIRE(cache != nullptr);
+  sameTree(cache->getTree(), tree);
+  REQUIRE(cache->interner()->size() == parser.interner()->size());
+  for (Symbol symbol = 0; symbol < parser.interner()->size(); ++symbol) {
+    REQUIRE(cache->interner()->name(symbol) == parser.interner()->name(symbol));
+  }
+
+  REQUIRE(AstCache::load(path, *SourceBuffer::fromString("PROGRAM other; BEGIN END.")) == nullptr);
+  {
+    // Point the program's first child back at the program itself.
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(56 + tree.size() * sizeof(int64_t) + (tree.size() + 1) * sizeof(FlatTree::Index)));
+    const FlatTree::Index self = 0;
+    file.write(reinterpret_cast<const char*>(&self), sizeof(self));
+  }
+  REQUIRE(AstCache::load(path, *source) == nullptr);
+  REQUIRE(AstCache::load(directory.file("missing.ast"), *source) == nullptr);
+
+  REQUIRE(AstCache::open(directory.path(), *SourceBuffer::fromString("PROGRAM broken; BEGIN a := END.")) == nullptr);
+}
+
+TEST_CASE("The iterative parser builds the recursive parser's trees", "[parser]") {
+  const char* const operators[] = {"+", "-", "*", "/", "<", "<=", ">", ">=", "==", "!=", "&&", "||"};
+  Random next(7);
+  std::function<std::string(int)> expression = [&](int depth) {
+    std::string text;
+    for (unsigned term = 0, terms = 1 + next(4); term < terms; ++term) {
+      if (term > 0) {
+        text += operators[next(12)];
+      }
+      switch (depth > 0 ? next(6) : next(2)) {
+        case 0: text += std::to_string(next(100)); break;
+        case 1: text += "x"; break;
+        case 2: text += "(" + expression(depth - 1) + ")"; break;
+        case 3: text += "- !" + expression(depth - 1); break;
+        case 4: text += "f(" + expression(depth - 1) + ", " + expression(depth - 1) + ")"; break;
+        default: text += "g()"; break;
+      }
+    }
+    return text;
+  };
+
+  std::string program = "PROGRAM test;\nBEGIN\n";
+  for (int i = 0; i < 200; ++i) {
+    program += i % 5 == 0 ? "  BEGIN BEGIN x := " + expression(4) + " END; f(" + expression(3) + ") END;\n"
+                          : "  x := " + expression(4) + ";\n";
+  }
+  // Unbalanced parentheses, a missing operand and a missing semicolon.
+  program += "  x := (1 + (2 * 3;\n  x := 4 + ;\n  x := f(1, (2) y := 1\nEND.\n";
+
+  std::vector<FlatTree> trees;
+  std::vector<std::shared_ptr<Diagnostics>> found;
+  for (bool iterative : {false, true}) {
+    Parser parser(SourceBuffer::fromString(program));
+    found.push_back(std::make_shared<Diagnostics>());
+    parser.setDiagnostics(found.back());
+    parser.setIterative(iterative);
+    trees.push_back(FlatTree::fromTree(*parser.program()));
+  }
+  sameTree(trees[1], trees[0]);
+  REQUIRE(found[0]->size() == 3);
+  REQUIRE(found[1]->size() == found[0]->size());
+  for (size_t i = 0; i < found[0]->size(); ++i) {
+    REQUIRE((*found[1])[i].offset == (*found[0])[i].offset);
+    REQUIRE((*found[1])[i].code == (*found[0])[i].code);
+  }
+}
+
+TEST_CASE("The iterative parser handles deep nesting up to its limit", "[parser]") {
+  const size_t levels = 200000;
+  std::string program = "PROGRAM deep;\nBEGIN\n  x := ";
+  program += std::string(levels, '(') + "- 1" + std::string(levels, ')') + ";\n";
+  for (size_t i = 0; i < levels; ++i) {
+    program += "BEGIN ";
+  }
+  program += "y := 2";
+  for (size_t i = 0; i < levels; ++i) {
+    program += " END";
+  }
+  program += ";\n  z := 3\nEND.\n";
+
+  Parser parser(SourceBuffer::fromString(program));
+  auto diagnostics = std::make_shared<Diagnostics>();
+  parser.setDiagnostics(diagnostics);
+  parser.setIterative(true);
+  auto& compound = dynamic_cast<Compound&>(*dynamic_cast<Block&>(*dynamic_cast<Program&>(*parser.program()).block).compoundStatement);
+  REQUIRE(diagnostics->empty());
+  REQUIRE(compound.children.size() == 3);
+  AST* inner = compound.children[1];
+  for (size_t i = 0; i < levels; ++i) {
+    inner = dynamic_cast<Compound&>(*inner).children[0];
+  }
+  REQUIRE(dynamic_cast<Assign*>(inner) != nullptr);
+
+  Parser limited(SourceBuffer::fromString(program));
+  diagnostics = std::make_shared<Diagnostics>();
+  limited.setDiagnostics(diagnostics);
+  limited.setIterative(true, 1000);
+  auto& skipped = dynamic_cast<Compound&>(*dynamic_cast<Block&>(*dynamic_cast<Program&>(*limited.program()).block).compoundStatement);
+  // One error per statement that nests too deeply; the statements after them still parse.
+  REQUIRE(diagnostics->size() == 2);
+  REQUIRE((*diagnostics)[0].code == DiagnosticCode::NESTING_TOO_DEEP);
+  REQUIRE((*diagnostics)[1].code == DiagnosticCode::NESTING_TOO_DEEP);
+  REQUIRE(skipped.children.size() == 3);
+  REQUIRE(dynamic_cast<Assign*>(skipped.children[2]) != nullptr);
+}
+
+TEST_CASE("Function bodies count toward the depth limit however they are parsed", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "FUNCTION f;\n"
+      "  FUNCTION g;\n"
+      "  BEGIN y := -(1) END;\n"
+      "BEGIN x := -1 END;\n"
+      "FUNCTION h;\n"
+      "BEGIN z := 2 END;\n"
+      "BEGIN f() END.\n";
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = std::make_shared<const std::vector<Token>>(tokenize(SourceBuffer::fromString(program), symbols));
+  for (size_t limit = 1; limit <= 5; ++limit) {
+    std::vector<std::vector<std::pair<uint32_t, DiagnosticCode>>> found;
+    std::vector<std::vector<FlatTree::Kind>> kinds;
+    for (int mode = 0; mode < 3; ++mode) {
+      Parser parser(tokens, symbols);
+      auto diagnostics = std::make_shared<Diagnostics>();
+      parser.setDiagnostics(diagnostics);
+      parser.setIterative(true, limit);
+      parser.setParallelFunctions(mode == 1, 2);
+      parser.setLazyFunctions(mode == 2);
+      // Flattening parses the lazy bodies.
+      kinds.push_back(FlatTree::fromTree(*parser.program()).kinds);
+      found.emplace_back();
+      for (size_t i = 0; i < diagnostics->size(); ++i) {
+        found.back().emplace_back((*diagnostics)[i].offset, (*diagnostics)[i].code);
+      }
+      std::sort(found.back().begin(), found.back().end());
+    }
+    // Exactly at the limit of the deepest statement, nothing is reported.
+    REQUIRE(found[0].empty() == (limit >= 5));
+    REQUIRE(found[1] == found[0]);
+    REQUIRE(found[2] == found[0]);
+    REQUIRE(kinds[1] == kinds[0]);
+    REQUIRE(kinds[2] == kinds[0]);
+  }
+}
+
+TEST_CASE("Deeply nested programs run", "[parser]") {
+  const size_t levels = 200000;
+  std::string program = "PROGRAM deep;\nVAR x, y, z : INTEGER;\nBEGIN\n  x := ";
+  for (size_t i = 0; i < levels; ++i) {
+    program += "- ";
+  }
+  program += "3;\n  y := ";
+  for (size_t i = 0; i < levels; ++i) {
+    program += "1 - (";
+  }
+  program += "1" + std::string(levels, ')') + ";\n  ";
+  for (size_t i = 0; i < levels; ++i) {
+    program += "BEGIN ";
+  }
+  program += "z := 7";
+  for (size_t i = 0; i < levels; ++i) {
+    program += " END";
+  }
+  program += "\nEND.\n";
+
+  Parser parser(SourceBuffer::fromString(program));
+  parser.setIterative(true);
+  auto& root = dynamic_cast<Program&>(*parser.program());
+  std::vector<int64_t> expected = {3, 1, 7};
+
+  PrintVisitor printer(parser.interner());
+  root.name->accept(printer);
+  printer.callstack = std::make_shared<ActivationRecord>(printer.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+  root.block->accept(printer);
+
+  FlatTree tree = FlatTree::fromTree(root);
+  FlatInterpreter interpreter(parser.interner());
+  interpreter.run(tree, tree.child(0, 0));
+  interpreter.callstack = std::make_shared<ActivationRecord>(interpreter.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+  interpreter.run(tree, tree.child(0, 1));
+
+  const char* names[] = {"x", "y", "z"};
+  for (size_t i = 0; i < 3; ++i) {
+    for (auto& globals : {printer.callstack, interpreter.callstack}) {
+      auto value = globals->get(parser.interner()->intern(names[i]));
+      REQUIRE(value != nullptr);
+      REQUIRE(dynamic_cast<NumberValue&>(*value).value == expected[i]);
+    }
+  }
+}
+
+TEST_CASE("Pipelined runs match whole-program runs", "[parser]") {
+  const std::string program =
+      "PROGRAM test;\n"
+      "VAR a, b : INTEGER;\n"
+      "FUNCTION first;\n"
+      "BEGIN second() END;\n"
+      "FUNCTION second;\n"
+      "BEGIN b := b + 5 END;\n"
+      "BEGIN\n"
+      "  a := 2;\n"
+      "  b := 10 * a;\n"
+      "  first();\n"
+      "  BEGIN a := a - - b; b := a * 3 END;\n"
+      "  c := a + b\n"
+      "END.\n";
+  auto ran = run(program);
+  for (size_t capacity : {1, 64}) {
+    Parser parser(SourceBuffer::fromString(program));
+    PrintVisitor printer(parser.interner());
+    AST* root = runPipelined(parser, printer, capacity);
+    auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*root).block);
+    REQUIRE(dynamic_cast<Compound&>(*block.compoundStatement).children.size() == 5);
+    for (const char* name : {"a", "b", "c"}) {
+      auto value = printer.callstack->get(parser.interner()->intern(name));
+      REQUIRE(value != nullptr);
+      REQUIRE(dynamic_cast<NumberValue&>(*value).value == valueOf(ran, name));
+    }
+  }
+}
+
+TEST_CASE("Pipelined runs stop at the first syntax error", "[parser]") {
+  Parser parser(SourceBuffer::fromString("PROGRAM test; BEGIN a := 1; b := 2 + ; c := 3 END."));
+  auto diagnostics = std::make_shared<Diagnostics>();
+  parser.setDiagnostics(diagnostics);
+  PrintVisitor printer(parser.interner());
+  runPipelined(parser, printer, 1);
+  REQUIRE(diagnostics->size() == 1);
+  REQUIRE(printer.callstack->get(parser.interner()->intern("a")) != nullptr);
+  REQUIRE(printer.callstack->get(parser.interner()->intern("b")) == nullptr);
+  REQUIRE(printer.callstack->get(parser.interner()->intern("c")) == nullptr);
+}
+
+TEST_CASE("Incremental parses reuse the functions an edit did not touch", "[parser]") {
+  std::string text = "PROGRAM test;\nVAR a : INTEGER;\n";
+  for (int i = 0; i < 30; ++i) {
+    text += "FUNCTION f" + std::to_string(i) + "(x : INTEGER);\nBEGIN\n  a := a * " + std::to_string(i) + " + (1 - x)\nEND;\n";
+  }
+  text += "BEGIN\n  a := 1;\n  f3(a)\nEND.\n";
+  IncrementalParser document(text);
+  REQUIRE(document.getDiagnostics()->empty());
+
+  auto matchesFreshParse = [&document]() {
+    Parser parser(SourceBuffer::fromString(document.getText()));
+    auto diagnostics = std::make_shared<Diagnostics>();
+    parser.setDiagnostics(diagnostics);
+    FlatTree expected = FlatTree::fromTree(*parser.program());
+    FlatTree tree = FlatTree::fromTree(*document.getTree());
+    sameShape(tree, expected);
+    REQUIRE(document.getDiagnostics()->size() == diagnostics->size());
+    for (size_t i = 0; i < diagnostics->size(); ++i) {
+      REQUIRE((*document.getDiagnostics())[i].offset == (*diagnostics)[i].offset);
+    }
+    // Symbols are numbered by first appearance, which edits reorder, so compare
+    // them by name; the interner keeps whichever spelling it saw first.
+    for (FlatTree::Index node = 0; node < tree.size(); ++node) {
+      if (tree.kinds[node] == FlatTree::VAR) {
+        const std::string& name = parser.interner()->name(static_cast<Symbol>(expected.values[node]));
+        REQUIRE(document.interner()->intern(name) == static_cast<Symbol>(tree.values[node]));
+      } else {
+        REQUIRE(tree.values[node] == expected.values[node]);
+      }
+    }
+  };
+
+  // An edit inside one body reparses only that function.
+  size_t at = document.getText().find("a * 12");
+  document.edit(at + 4, 2, "7 - 5");
+  REQUIRE(document.reused() == 29);
+  matchesFreshParse();
+
+  // A syntax error is reported, and reported again after unrelated edits.
+  at = document.getText().find("(1 - x)", document.getText().find("FUNCTION f20"));
+  document.edit(at + 3, 1, "");
+  REQUIRE(document.getDiagnostics()->size() == 1);
+  matchesFreshParse();
+  document.edit(document.getText().find("a := 1;"), 0, "a := 2;\n  ");
+  REQUIRE(document.reused() == 29);
+  REQUIRE(document.getDiagnostics()->size() == 1);
+  matchesFreshParse();
+
+  // Random edits, including ones that split or merge functions, always leave
+  // the tree a fresh parse would build.
+  const char* const snippets[] = {"", " ", "x", "1", "+", ";", "END;", "BEGIN", "FUNCTION g;", "(", ")", "a := 3;"};
+  Random next(11);
+  for (int i = 0; i < 200; ++i) {
+    size_t offset = next(static_cast<unsigned>(document.getText().size()));
+    size_t removed = std::min<size_t>(next(4), document.getText().size() - offset);
+    try {
+      document.edit(offset, removed, snippets[next(12)]);
+    } catch (const std::invalid_argument&) {
+      continue;
+    }
+    matchesFreshParse();
+  }
+}
+
+TEST_CASE("Hash consing shares equal subtrees", "[parser]") {
+  std::string program = "PROGRAM test;\nVAR a, b : INTEGER;\n  c : INTEGER;\nBEGIN\n  a := 1; b := 2;\n";
+  for (int i = 0; i < 50; ++i) {
+    program += "  c := (a + b * 3) - -(a + b * 3) + " + std::to_string(i % 5) + ";\n";
+  }
+  program += "  a := c + (a + b * 3)\nEND.\n";
+  auto ran = run(program);
+
+  std::vector<size_t> used;
+  for (bool consing : {false, true}) {
+    for (bool iterative : {false, true}) {
+      Parser parser(SourceBuffer::fromString(program));
+      parser.setHashConsing(consing);
+      parser.setIterative(iterative);
+      AST* root = parser.program();
+      used.push_back(parser.arena()->bytesUsed());
+      if (!consing) {
+        continue;
+      }
+      auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*root).block);
+      auto& statements = dynamic_cast<Compound&>(*block.compoundStatement).children;
+      // Equal expressions are one node, so comparing them takes one comparison.
+      auto& first = dynamic_cast<BinaryOp&>(*dynamic_cast<BinaryOp&>(*dynamic_cast<Assign&>(*statements[2]).right).left);
+      auto& last = dynamic_cast<BinaryOp&>(*dynamic_cast<Assign&>(*statements[statements.size() - 1]).right);
+      REQUIRE(first.left == last.right);
+      REQUIRE(dynamic_cast<UnaryOp&>(*first.right).node == first.left);
+      REQUIRE(statements[2] != statements[7]);
+      REQUIRE(dynamic_cast<Assign&>(*statements[2]).right == dynamic_cast<Assign&>(*statements[7]).right);
+      REQUIRE(dynamic_cast<VarDecl&>(*block.declarations[0]).type == dynamic_cast<VarDecl&>(*block.declarations[2]).type);
+
+      PrintVisitor printer(parser.interner());
+      auto& node = dynamic_cast<Program&>(*root);
+      node.name->accept(printer);
+      printer.callstack = std::make_shared<ActivationRecord>(printer.name, ActivationRecord::Type::PROGRAM, 1, nullptr);
+      node.block->accept(printer);
+      for (const char* name : {"a", "b", "c"}) {
+        auto value = printer.callstack->get(parser.interner()->intern(name));
+        REQUIRE(value != nullptr);
+        REQUIRE(dynamic_cast<NumberValue&>(*value).value == valueOf(ran, name));
+      }
+    }
+  }
+  REQUIRE(used[1] == used[0]);
+  REQUIRE(used[3] == used[2]);
+  REQUIRE(used[2] * 4 < used[0]);
+}
+
+TEST_CASE("Hash consing shares subtrees across parallel function bodies", "[parser]") {
+  std::string program = "PROGRAM test;\nVAR a : INTEGER;\n";
+  for (int i = 0; i < 12; ++i) {
+    program += "FUNCTION f" + std::to_string(i) + ";\nBEGIN a := (a + 7) * 3 END;\n";
+  }
+  program += "BEGIN\n  a := (a + 7) * 3\nEND.\n";
+  auto symbols = std::make_shared<Interner>();
+  auto tokens = std::make_shared<const std::vector<Token>>(tokenize(SourceBuffer::fromString(program), symbols));
+  Parser parser(tokens, symbols);
+  parser.setHashConsing(true);
+  parser.setParallelFunctions(true, 3);
+  auto& block = dynamic_cast<Block&>(*dynamic_cast<Program&>(*parser.program()).block);
+  AST* expression = dynamic_cast<Assign&>(*dynamic_cast<Compound&>(*block.compoundStatement).children[0]).right;
+  REQUIRE(block.declarations.size() == 13);
+  for (size_t i = 1; i < block.declarations.size(); ++i) {
+    auto& body = dynamic_cast<Block&>(*dynamic_cast<FunctionDecl&>(*block.declarations[i]).body());
+    REQUIRE(dynamic_cast<Assign&>(*dynamic_cast<Compound&>(*body.compoundStatement).children[0]).right == expression);
+  }
+}